@@ -8,19 +8,43 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+// the next offset in sbuf to append samples to, see nemu/src/device/audio.c
+static int wpos = 0;
+
 void __am_audio_init() {
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->present = true;
+  cfg->bufsize = inl(AUDIO_SBUF_SIZE_ADDR);
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
+  wpos = 0;
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  uint8_t *buf = ctl->buf.start;
+  int len = ctl->buf.end - ctl->buf.start;
+  int bufsize = inl(AUDIO_SBUF_SIZE_ADDR);
+  while (len > 0) {
+    // wait until there is free space
+    int count = inl(AUDIO_COUNT_ADDR);
+    int n = (bufsize - count < len ? bufsize - count : len);
+    for (int i = 0; i < n; i ++) {
+      outb(AUDIO_SBUF_ADDR + wpos, buf[i]);
+      wpos = (wpos + 1 == bufsize ? 0 : wpos + 1);
+    }
+    outl(AUDIO_COUNT_ADDR, count + n);
+    buf += n;
+    len -= n;
+  }
 }
@@ -1,12 +1,35 @@
 #include <am.h>
 #include <nemu.h>
 
+#define DISK_BLKSZ_ADDR  (DISK_ADDR + 0x00)
+#define DISK_BLKCNT_ADDR (DISK_ADDR + 0x04)
+#define DISK_BUF_ADDR    (DISK_ADDR + 0x08)
+#define DISK_BLKNO_ADDR  (DISK_ADDR + 0x0c)
+#define DISK_COUNT_ADDR  (DISK_ADDR + 0x10)
+#define DISK_CMD_ADDR    (DISK_ADDR + 0x14)
+#define DISK_STATUS_ADDR (DISK_ADDR + 0x18)
+
+// see nemu/src/device/disk.c
+enum { DISK_CMD_NONE, DISK_CMD_READ, DISK_CMD_WRITE };
+enum { DISK_OK, DISK_ERROR };
+
 void __am_disk_config(AM_DISK_CONFIG_T *cfg) {
-  cfg->present = false;
+  cfg->blksz = inl(DISK_BLKSZ_ADDR);
+  cfg->blkcnt = inl(DISK_BLKCNT_ADDR);
+  cfg->present = (cfg->blkcnt != 0);
 }
 
 void __am_disk_status(AM_DISK_STATUS_T *stat) {
+  // the device clears the command when the transfer is done
+  stat->ready = (inl(DISK_CMD_ADDR) == DISK_CMD_NONE);
 }
 
 void __am_disk_blkio(AM_DISK_BLKIO_T *io) {
+  // the device copies the blocks between the disk and the buffer directly
+  outl(DISK_BUF_ADDR, (uintptr_t)io->buf);
+  outl(DISK_BLKNO_ADDR, io->blkno);
+  outl(DISK_COUNT_ADDR, io->blkcnt);
+  outl(DISK_CMD_ADDR, io->write ? DISK_CMD_WRITE : DISK_CMD_READ);
+  while (inl(DISK_CMD_ADDR) != DISK_CMD_NONE);
+  panic_on(inl(DISK_STATUS_ADDR) != DISK_OK, "disk I/O error");
 }
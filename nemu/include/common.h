@@ -44,6 +44,9 @@ typedef MUXDEF(PMEM64, uint64_t, uint32_t) paddr_t;
 #define FMT_PADDR MUXDEF(PMEM64, "0x%016" PRIx64, "0x%08" PRIx32)
 typedef uint16_t ioaddr_t;
 
+// state private to each hart, which runs on its own host thread with SMP
+#define HART_LOCAL MUXDEF(CONFIG_SMP, __thread, )
+
 #include <debug.h>
 
 #endif
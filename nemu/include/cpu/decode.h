@@ -23,9 +23,71 @@ typedef struct Decode {
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
+  IFDEF(CONFIG_ICACHE, const void *handler); // where decode_exec() resumes for a decoded instruction
+  IFDEF(CONFIG_FUSION, int nr_inst); // max number of instructions to fuse before execution, number executed after
   IFDEF(CONFIG_ITRACE, char logbuf[128]);
 } Decode;
 
+// --- decoded-instruction cache ---
+#ifdef CONFIG_ICACHE
+#if (CONFIG_ICACHE_SIZE & (CONFIG_ICACHE_SIZE - 1)) != 0
+#error CONFIG_ICACHE_SIZE should be a power of 2
+#endif
+
+typedef struct {
+  vaddr_t tag; // pc | 1, or 0 if the entry is invalid
+  vaddr_t snpc;
+  ISADecodeInfo isa;
+  const void *handler;
+} ICacheEntry;
+
+extern ICacheEntry icache[CONFIG_ICACHE_SIZE];
+
+static inline ICacheEntry* icache_entry(vaddr_t pc) {
+  return &icache[(pc >> 2) & (CONFIG_ICACHE_SIZE - 1)];
+}
+
+// restore the decoding result of `s->pc' into `s', return false on miss
+static inline bool icache_lookup(Decode *s) {
+  ICacheEntry *e = icache_entry(s->pc);
+  if (likely(e->tag == (s->pc | 1))) {
+    s->snpc = e->snpc;
+    s->isa = e->isa;
+    s->handler = e->handler;
+    return true;
+  }
+  s->handler = NULL;
+  return false;
+}
+
+static inline void icache_fill(Decode *s, const void *handler) {
+  ICacheEntry *e = icache_entry(s->pc);
+  e->tag = s->pc | 1;
+  e->snpc = s->snpc;
+  e->isa = s->isa;
+  e->handler = handler;
+}
+
+// Called on every store to keep the cache coherent with self-modifying code.
+// The cache is indexed by pc but invalidated by the physical address of the
+// store, which are the same without MMU. With Sv32 it is flushed on every
+// satp write, but a store to a code page mapped at a different virtual
+// address still leaves the decoded instructions of that page stale.
+static inline void icache_invalidate(paddr_t addr, int len) {
+  for (paddr_t a = addr & ~(paddr_t)3; a < addr + len; a += 4) {
+    ICacheEntry *e = icache_entry(a);
+    if (e->tag == (a | 1)) { e->tag = 0; }
+#ifdef CONFIG_FUSION
+    // a superinstruction also covers the next instruction
+    e = icache_entry(a - 4);
+    if (e->tag == ((a - 4) | 1) && e->snpc > a) { e->tag = 0; }
+#endif
+  }
+}
+
+void icache_flush();
+#endif
+
 // --- pattern matching mechanism ---
 __attribute__((always_inline))
 static inline void pattern_decode(const char *str, int len,
@@ -87,10 +149,32 @@ finish:
 
 
 // --- pattern matching wrappers for decode ---
+#ifdef CONFIG_DECODE_TREE
+// INSTPAT_TREE() is generated from the INSTPAT table by tools/gen-decode,
+// it jumps to the first matching pattern through the labels named by line
+#define INSTPAT_DISPATCH(s) INSTPAT_TREE((uint64_t)INSTPAT_INST(s))
+#define INSTPAT_LABEL concat(__instpat_line_, __LINE__): __attribute__((unused));
+#else
+#define INSTPAT_DISPATCH(s)
+#define INSTPAT_LABEL
+#endif
+
+#ifdef CONFIG_PROFILE
+// count the executions of the instruction named `name' for the profiler
+#define INSTPAT_COUNT(name) do { \
+  static uint64_t *__cnt = NULL; \
+  if (unlikely(__cnt == NULL)) __cnt = profile_inst_counter(str(name)); \
+  (*__cnt) ++; \
+} while (0)
+#else
+#define INSTPAT_COUNT(name)
+#endif
+
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    INSTPAT_LABEL \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
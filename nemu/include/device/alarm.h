@@ -20,5 +20,9 @@
 
 typedef void (*alarm_handler_t) ();
 void add_alarm_handle(alarm_handler_t h);
+#ifdef CONFIG_ICOUNT
+uint64_t alarm_remaining();
+void alarm_update();
+#endif
 
 #endif
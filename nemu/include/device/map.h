@@ -21,6 +21,11 @@
 typedef void(*io_callback_t)(uint32_t, int, bool);
 uint8_t* new_space(int size);
 
+enum {
+  IOMAP_IO,  // device registers, accessed through `callback'
+  IOMAP_RAM, // plain memory in the IO space, accessed directly by its host address
+};
+
 typedef struct {
   const char *name;
   // we treat ioaddr_t as paddr_t here
@@ -28,6 +33,7 @@ typedef struct {
   paddr_t high;
   void *space;
   io_callback_t callback;
+  int type;
 } IOMap;
 
 static inline bool map_inside(IOMap *map, paddr_t addr) {
@@ -48,9 +54,23 @@ static inline int find_mapid_by_addr(IOMap *maps, int size, paddr_t addr) {
 void add_pio_map(const char *name, ioaddr_t addr,
         void *space, uint32_t len, io_callback_t callback);
 void add_mmio_map(const char *name, paddr_t addr,
-        void *space, uint32_t len, io_callback_t callback);
+        void *space, uint32_t len, io_callback_t callback, int type);
+
+// host address of the page `pg' if it is entirely in an IOMAP_RAM map, or NULL
+uint8_t* mmio_ram_page(paddr_t pg);
+
+// writes to IOMAP_RAM maps mark the pages of the IO space dirty
+void io_space_set_dirty(uint8_t *p, int len);
+// return whether a page in [p, p + len) is dirty, and clean them
+bool io_space_test_and_clean(uint8_t *p, uint32_t len);
 
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
 
+#ifdef CONFIG_SMP
+// serialize the device accesses from the harts and device_update()
+void device_lock();
+void device_unlock();
+#endif
+
 #endif
@@ -26,11 +26,33 @@
 uint8_t* guest_to_host(paddr_t paddr);
 /* convert the host virtual address in NEMU to guest physical address in the guest program */
 paddr_t host_to_guest(uint8_t *haddr);
+/* make pmem in [paddr, paddr + len) accessible by system calls, which
+ * do not trigger the lazy allocation */
+void pmem_populate(paddr_t paddr, size_t len);
+/* throw away the decoded instructions in pmem [paddr, paddr + len),
+ * which is about to be written by the host without paddr_write() */
+void pmem_invalidate(paddr_t paddr, size_t len);
+/* map `size' bytes of the file `fd' copy-on-write to pmem at `paddr',
+ * return false if it is not supported */
+bool pmem_map_file(paddr_t paddr, int fd, size_t size);
+
+#ifdef CONFIG_CACHE_SIM
+// the cache hierarchy model, `type' is one of MEM_TYPE_*
+void init_cache();
+void cache_access(paddr_t addr, int len, int type);
+void cache_statistic(uint64_t nr_inst);
+#endif
 
 static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+/* the range is checked on the host side, as host_to_guest() truncates
+ * the host addresses out of pmem */
+static inline bool host_in_pmem(uint8_t *haddr) {
+  return (uintptr_t)(haddr - guest_to_host(CONFIG_MBASE)) < CONFIG_MSIZE;
+}
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
@@ -18,12 +18,59 @@
 
 #include <common.h>
 
-word_t vaddr_ifetch(vaddr_t addr, int len);
-word_t vaddr_read(vaddr_t addr, int len);
-void vaddr_write(vaddr_t addr, int len, word_t data);
-
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
 
+void vaddr_write(vaddr_t addr, int len, word_t data);
+// the physical address of `addr' to access by `type', it should not fail
+paddr_t vaddr_translate(vaddr_t addr, int len, int type);
+
+#ifdef CONFIG_SOFT_TLB
+#include <isa.h>
+#include <memory/host.h>
+
+#if (CONFIG_SOFT_TLB_SIZE & (CONFIG_SOFT_TLB_SIZE - 1)) != 0
+#error CONFIG_SOFT_TLB_SIZE should be a power of 2
+#endif
+
+/* Software TLB, one for each access type. An entry maps a guest virtual
+ * page in pmem to its host address, so that an access hitting in the TLB
+ * neither translates the address nor checks the memory range. Pages of
+ * devices are only cached if they are in a RAM-like map (IOMAP_RAM).
+ */
+typedef struct {
+  vaddr_t tag;      // guest virtual address of the page, or -1 if the entry is invalid
+  uintptr_t addend; // host address - guest virtual address
+} SoftTLBEntry;
+
+extern HART_LOCAL SoftTLBEntry soft_tlb[3][CONFIG_SOFT_TLB_SIZE]; // indexed by MEM_TYPE_*
+
+// return the host address of `addr', or NULL on miss or unaligned access
+static inline uint8_t* soft_tlb_lookup(vaddr_t addr, int len, int type) {
+  SoftTLBEntry *e = &soft_tlb[type][(addr >> PAGE_SHIFT) & (CONFIG_SOFT_TLB_SIZE - 1)];
+  if (likely((addr & (~(vaddr_t)PAGE_MASK | (len - 1))) == e->tag)) {
+    return (uint8_t *)(uintptr_t)addr + e->addend;
+  }
+  return NULL;
+}
+
+// should be called when the address translation changes
+void soft_tlb_flush();
+word_t vaddr_read_slow(vaddr_t addr, int len, int type);
+
+static inline word_t vaddr_ifetch(vaddr_t addr, int len) {
+  uint8_t *p = soft_tlb_lookup(addr, len, MEM_TYPE_IFETCH);
+  return (likely(p != NULL) ? host_read(p, len) : vaddr_read_slow(addr, len, MEM_TYPE_IFETCH));
+}
+
+static inline word_t vaddr_read(vaddr_t addr, int len) {
+  uint8_t *p = soft_tlb_lookup(addr, len, MEM_TYPE_READ);
+  return (likely(p != NULL) ? host_read(p, len) : vaddr_read_slow(addr, len, MEM_TYPE_READ));
+}
+#else
+word_t vaddr_ifetch(vaddr_t addr, int len);
+word_t vaddr_read(vaddr_t addr, int len);
+#endif
+
 #endif
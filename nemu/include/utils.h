@@ -33,6 +33,24 @@ extern NEMUState nemu_state;
 // ----------- timer -----------
 
 uint64_t get_time();
+uint64_t get_guest_time();
+
+// ----------- profile -----------
+
+#ifdef CONFIG_PROFILE
+uint64_t* profile_inst_counter(const char *name);
+void profile_exec(vaddr_t pc, bool taken);
+void profile_dump();
+#endif
+
+// ----------- mtrace -----------
+
+#ifdef CONFIG_MTRACE
+void init_mtrace();
+void mtrace_access(paddr_t addr, int len, word_t data, int type);
+void mtrace_close();
+bool log_enable(); // accesses are traced within the log window only
+#endif
 
 // ----------- log -----------
 
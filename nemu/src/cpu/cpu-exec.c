@@ -16,6 +16,7 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <memory/paddr.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -26,29 +27,39 @@
 #define MAX_INST_TO_PRINT 10
 
 void wp_difftest();
+bool wp_active();
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
+HART_LOCAL CPU_state cpu = {};
+HART_LOCAL uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+uint64_t device_quantum();
+void smp_start(void (*execute)(uint64_t));
+void smp_stop();
+uint64_t smp_nr_guest_inst();
 
-static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
-#ifdef CONFIG_ITRACE_COND
-  if (ITRACE_COND) { log_write("%s\n", _this->logbuf); }
-#endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
-  IFDEF(CONFIG_WATCHPOINT, wp_difftest());
+/* Features observing every instruction executed. The execute loop of
+ * the interpreter is specialized on each combination of them, so that
+ * those turned off cost nothing.
+ */
+#define EXEC_ITRACE 0x1 // log the instructions (ITRACE)
+#define EXEC_PRINT  0x2 // print the instructions executed by `si'
+#define EXEC_DIFF   0x4 // differential testing
+#define EXEC_WATCH  0x8 // check watchpoints
+static int g_features = 0;
+
+static int exec_features() {
+  int f = 0;
+  if (ISDEF(CONFIG_ITRACE)) f |= EXEC_ITRACE | (g_print_step ? EXEC_PRINT : 0);
+  if (ISDEF(CONFIG_DIFFTEST)) f |= EXEC_DIFF;
+  if (MUXDEF(CONFIG_WATCHPOINT, wp_active(), false)) f |= EXEC_WATCH;
+  return f;
 }
 
-static void exec_once(Decode *s, vaddr_t pc) {
-  s->pc = pc;
-  s->snpc = pc;
-  isa_exec_once(s);
-  cpu.pc = s->dnpc;
 #ifdef CONFIG_ITRACE
+static void itrace_fill(Decode *s) {
   char *p = s->logbuf;
   p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
   int ilen = s->snpc - s->pc;
@@ -67,27 +78,181 @@ static void exec_once(Decode *s, vaddr_t pc) {
   void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
   disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
       MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst.val, ilen);
+}
+#endif
+
+__attribute__((always_inline))
+static inline void trace_and_difftest(Decode *_this, vaddr_t dnpc, int features) {
+#ifdef CONFIG_PROFILE
+  vaddr_t pc = _this->pc;
+#ifdef CONFIG_FUSION
+  // the instructions in a superinstruction are sequential
+  if (_this->nr_inst == 2) { profile_exec(pc, false); pc += 4; }
 #endif
+  profile_exec(pc, dnpc != _this->snpc);
+#endif
+#ifdef CONFIG_ITRACE
+  // the log is only built when someone reads it
+  bool log = false;
+#ifdef CONFIG_ITRACE_COND
+  log = (features & EXEC_ITRACE) && ITRACE_COND;
+#endif
+  if (log || (features & EXEC_PRINT)) {
+    itrace_fill(_this);
+    if (log) { log_write("%s\n", _this->logbuf); }
+    if (features & EXEC_PRINT) { puts(_this->logbuf); }
+  }
+#endif
+  if (features & EXEC_DIFF) { IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc)); }
+  if (features & EXEC_WATCH) { IFDEF(CONFIG_WATCHPOINT, wp_difftest()); }
+}
+
+static void exec_once(Decode *s, vaddr_t pc) {
+  s->pc = pc;
+  s->snpc = pc;
+  isa_exec_once(s);
+  cpu.pc = s->dnpc;
+}
+
+#ifdef CONFIG_BLOCK_CACHE
+#include <block.h>
+
+/* Execute instructions from `cpu.pc' one by one, and record them into a new
+ * block until the control flow leaves the straight-line code.
+ * Return the new block, or NULL if the block is dropped.
+ */
+static Block* exec_and_record(Decode *s, uint64_t *n) {
+  uint64_t gen = block_gen;
+  Block *b = block_new(cpu.pc);
+  while (*n > 0) {
+    exec_once(s, cpu.pc);
+    g_nr_guest_inst ++;
+    (*n) --;
+    trace_and_difftest(s, cpu.pc, g_features);
+    if (block_gen != gen) return NULL; // the code is modified
+    if (!block_append(b, s->pc) || s->dnpc != s->snpc) {
+      block_commit(b);
+      return (b->nr_inst > 0 ? b : NULL);
+    }
+    if (nemu_state.state != NEMU_RUNNING) return NULL;
+  }
+  // the block may be incomplete, record it again next time
+  return NULL;
+}
+
+/* Return `b' if it is still valid after execution. */
+static Block* exec_block(Decode *s, Block *b, uint64_t *n) {
+  uint64_t gen = block_gen;
+  vaddr_t pc = b->pc;
+  ICacheEntry *e = b->inst;
+  for (int i = b->nr_inst; i > 0 && *n > 0; i --, e ++) {
+    s->pc = pc;
+    s->snpc = e->snpc;
+    s->isa = e->isa;
+    s->handler = e->handler;
+    isa_exec_decoded(s);
+    cpu.pc = s->dnpc;
+    g_nr_guest_inst ++;
+    (*n) --;
+    trace_and_difftest(s, cpu.pc, g_features);
+    if (unlikely(block_gen != gen)) return NULL;
+    if (s->dnpc != s->snpc || nemu_state.state != NEMU_RUNNING) break;
+    pc = s->dnpc;
+  }
+  return b;
 }
 
+#ifdef CONFIG_ENGINE_JIT
+#include <jit.h>
+
+/* Run the host code of `b', return `b' if it is still valid after execution. */
+static Block* exec_native(Block *b, uint64_t *n) {
+  uint64_t gen = block_gen;
+  uint32_t nr_inst = jit_run(b);
+  g_nr_guest_inst += nr_inst;
+  (*n) -= nr_inst;
+  return (block_gen == gen ? b : NULL);
+}
+#endif
+
 static void execute(uint64_t n) {
   Decode s;
-  for (;n > 0; n --) {
+  Block *b = NULL;
+  while (n > 0) {
+    Block *next = (b == NULL ? block_lookup(cpu.pc) : block_chain(b, cpu.pc));
+    if (next == NULL) b = exec_and_record(&s, &n);
+#ifdef CONFIG_ENGINE_JIT
+    // the host code runs through the block without being observed,
+    // so it should fit in the budget, and it is not profiled;
+    // it also accesses pmem without address translation
+    else if (!ISDEF(CONFIG_PROFILE) && g_features == 0 && n >= next->nr_inst &&
+        isa_mmu_check(cpu.pc, 4, MEM_TYPE_IFETCH) == MMU_DIRECT) {
+      uint64_t gen = block_gen;
+      if (jit_code(next) != NULL) b = exec_native(next, &n);
+      // translation flushes all blocks, including `next', when the code cache is full
+      else b = (block_gen == gen ? exec_block(&s, next, &n) : NULL);
+    }
+#endif
+    else b = exec_block(&s, next, &n);
+    if (nemu_state.state != NEMU_RUNNING) break;
+  }
+}
+#else
+__attribute__((always_inline))
+static inline void execute_loop(uint64_t n, int features) {
+  Decode s;
+  while (n > 0) {
+    // a superinstruction hides the boundary between its instructions
+    IFDEF(CONFIG_FUSION, s.nr_inst = (features == 0 && n >= 2 ? 2 : 1));
     exec_once(&s, cpu.pc);
-    g_nr_guest_inst ++;
-    trace_and_difftest(&s, cpu.pc);
+    uint64_t nr_inst = MUXDEF(CONFIG_FUSION, s.nr_inst, 1);
+    g_nr_guest_inst += nr_inst;
+    n -= nr_inst;
+    trace_and_difftest(&s, cpu.pc, features);
+    if (nemu_state.state != NEMU_RUNNING) break;
+  }
+}
+
+#define EXEC_VARIANTS(f) \
+  f(0x0) f(0x1) f(0x2) f(0x3) f(0x4) f(0x5) f(0x6) f(0x7) \
+  f(0x8) f(0x9) f(0xa) f(0xb) f(0xc) f(0xd) f(0xe) f(0xf)
+#define DEF_EXECUTE(f) static void concat(execute_, f)(uint64_t n) { execute_loop(n, f); }
+#define EXECUTE_ENTRY(f) [f] = concat(execute_, f),
+
+MAP(EXEC_VARIANTS, DEF_EXECUTE)
+static void (*execute_table[])(uint64_t) = { MAP(EXEC_VARIANTS, EXECUTE_ENTRY) };
+
+static void execute(uint64_t n) {
+  execute_table[g_features](n);
+}
+#endif
+
+#ifdef CONFIG_DEVICE
+/* Run the CPU in quanta, and service the devices in between, so that
+ * the devices do not cost anything on each instruction.
+ */
+static void execute_with_device(uint64_t n) {
+  while (n > 0) {
+    uint64_t quantum = device_quantum();
+    if (quantum > n) quantum = n;
+    execute(quantum);
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    n -= quantum;
+    device_update();
   }
 }
+#endif
 
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
-  Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
-  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
+  uint64_t nr_inst = g_nr_guest_inst + MUXDEF(CONFIG_SMP, smp_nr_guest_inst(), 0);
+  Log("total guest instructions = " NUMBERIC_FMT, nr_inst);
+  if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", nr_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_RV_SV32, isa_mmu_statistic());
+  IFDEF(CONFIG_CACHE_SIM, cache_statistic(nr_inst));
 }
 
 void assert_fail_msg() {
@@ -105,9 +270,15 @@ void cpu_exec(uint64_t n) {
     default: nemu_state.state = NEMU_RUNNING;
   }
 
+  // watchpoints are only added or removed by sdb between two calls
+  g_features = exec_features();
+
   uint64_t timer_start = get_time();
 
-  execute(n);
+  // the other harts are not observed
+  IFDEF(CONFIG_SMP, smp_start(execute_table[0]));
+  MUXDEF(CONFIG_DEVICE, execute_with_device, execute)(n);
+  IFDEF(CONFIG_SMP, smp_stop());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
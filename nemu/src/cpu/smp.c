@@ -0,0 +1,102 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_SMP
+#include <pthread.h>
+
+/* Hart 0 runs on the main thread, and each of the other harts runs on a
+ * host thread of its own, whose thread-local storage keeps the CPU state
+ * of the hart. The threads live as long as NEMU, they are woken up when
+ * hart 0 starts to run in cpu_exec(), and parked when it stops.
+ */
+
+// number of instructions run between two checks of the stop request
+#define HART_QUANTUM 4096
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+
+static pthread_t thread[CONFIG_NR_HART];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_run = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_idle = PTHREAD_COND_INITIALIZER;
+static uint64_t nr_run = 0; // number of times the harts are started
+static int nr_busy = 0;
+static bool stop = false;
+static void (*hart_execute)(uint64_t) = NULL;
+static uint64_t nr_inst = 0; // instructions executed by harts other than hart 0
+static vaddr_t boot_pc = 0;
+
+// called after the image is loaded, which may move the entry of hart 0
+void init_smp() {
+  boot_pc = cpu.pc;
+}
+
+static void* hart_main(void *arg) {
+  IFDEF(CONFIG_SOFT_TLB, soft_tlb_flush());
+  isa_hart_init((intptr_t)arg, boot_pc);
+  uint64_t last = 0;
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (nr_run == last) pthread_cond_wait(&cond_run, &lock);
+    last = nr_run;
+    pthread_mutex_unlock(&lock);
+
+    uint64_t start = g_nr_guest_inst;
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE) && nemu_state.state == NEMU_RUNNING) {
+      hart_execute(HART_QUANTUM);
+    }
+
+    pthread_mutex_lock(&lock);
+    nr_inst += g_nr_guest_inst - start;
+    if (-- nr_busy == 0) pthread_cond_signal(&cond_idle);
+  }
+  return NULL;
+}
+
+// let the other harts run with `execute' until smp_stop()
+void smp_start(void (*execute)(uint64_t)) {
+  static bool created = false;
+  pthread_mutex_lock(&lock);
+  if (!created) {
+    for (intptr_t i = 1; i < CONFIG_NR_HART; i ++) {
+      int ret = pthread_create(&thread[i], NULL, hart_main, (void *)i);
+      Assert(ret == 0, "Can not create the thread of hart %d", (int)i);
+    }
+    created = true;
+  }
+  hart_execute = execute;
+  __atomic_store_n(&stop, false, __ATOMIC_RELEASE);
+  nr_busy = CONFIG_NR_HART - 1;
+  nr_run ++;
+  pthread_cond_broadcast(&cond_run);
+  pthread_mutex_unlock(&lock);
+}
+
+// wait until the other harts are parked
+void smp_stop() {
+  pthread_mutex_lock(&lock);
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  while (nr_busy > 0) pthread_cond_wait(&cond_idle, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+uint64_t smp_nr_guest_inst() {
+  return nr_inst;
+}
+#endif
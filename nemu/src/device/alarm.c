@@ -35,6 +35,28 @@ static void alarm_sig_handler(int signum) {
   }
 }
 
+#ifdef CONFIG_ICOUNT
+// the alarm is driven by the instruction count instead of SIGVTALRM
+#define ALARM_PERIOD (1000000000ull / TIMER_HZ / CONFIG_ICOUNT_NS)
+static_assert(ALARM_PERIOD > 0, "CONFIG_ICOUNT_NS is too large");
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+static uint64_t next_alarm = ALARM_PERIOD;
+
+// number of instructions before the next alarm
+uint64_t alarm_remaining() {
+  return (next_alarm > g_nr_guest_inst ? next_alarm - g_nr_guest_inst : 0);
+}
+
+void alarm_update() {
+  if (g_nr_guest_inst < next_alarm) return;
+  next_alarm = (g_nr_guest_inst / ALARM_PERIOD + 1) * ALARM_PERIOD;
+  alarm_sig_handler(SIGVTALRM);
+}
+
+void init_alarm() {
+}
+#else
 void init_alarm() {
   struct sigaction s;
   memset(&s, 0, sizeof(s));
@@ -49,3 +71,4 @@ void init_alarm() {
   ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
   Assert(ret == 0, "Can not set timer");
 }
+#endif
@@ -30,18 +30,77 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+// sbuf is a ring buffer with the guest as the only producer and the SDL
+// audio callback as the only consumer, so `count` is the only shared state.
+// Writing reg_init empties it, and the guest appends from offset 0 of sbuf
+// on, wrapping at reg_sbuf_size. It then writes the count it has read
+// plus the number of bytes appended back to reg_count.
+static uint32_t count = 0;      // bytes in sbuf, updated with atomics only
+static uint32_t count_seen = 0; // the value of reg_count last seen by the guest
+static uint32_t sbuf_head = 0;  // next byte to play, owned by the callback
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t nread = __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+  if (nread > len) nread = len;
+  uint32_t n = CONFIG_SB_SIZE - sbuf_head;
+  if (n > nread) n = nread;
+  memcpy(stream, sbuf + sbuf_head, n);
+  memcpy(stream + n, sbuf, nread - n);
+  sbuf_head = (sbuf_head + nread) % CONFIG_SB_SIZE;
+  if (nread < len) memset(stream + nread, 0, len - nread);
+  __atomic_fetch_sub(&count, nread, __ATOMIC_RELEASE);
+}
+
+static void init_sdl_audio() {
+  SDL_AudioSpec s = {};
+  s.freq = audio_base[reg_freq];
+  s.format = AUDIO_S16SYS;
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  s.userdata = NULL;
+
+  static bool opened = false;
+  if (opened) SDL_CloseAudio(); // the callback is stopped after closing
+  else SDL_InitSubSystem(SDL_INIT_AUDIO);
+  count = count_seen = sbuf_head = 0;
+  opened = (SDL_OpenAudio(&s, NULL) == 0);
+  if (!opened) {
+    Log("Can not open audio device, samples will not be played");
+    return;
+  }
+  SDL_PauseAudio(0);
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init]) init_sdl_audio();
+      break;
+    case reg_count:
+      if (is_write) {
+        // the guest writes back what it has seen plus what it has appended,
+        // while the callback may have drained some bytes in between
+        __atomic_fetch_add(&count, audio_base[reg_count] - count_seen, __ATOMIC_RELEASE);
+        count_seen = audio_base[reg_count];
+      } else {
+        count_seen = __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+        audio_base[reg_count] = count_seen;
+      }
+      break;
+  }
 }
 
 void init_audio() {
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 #ifdef CONFIG_HAS_PORT_IO
   add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_io_handler);
 #else
-  add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler);
+  add_mmio_map("audio", CONFIG_AUDIO_CTL_MMIO, audio_base, space_size, audio_io_handler, IOMAP_IO);
 #endif
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
-  add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
+  add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL, IOMAP_RAM);
 }
@@ -16,6 +16,7 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/map.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
@@ -33,14 +34,34 @@ void init_alarm();
 void send_key(uint8_t, bool);
 void vga_update_screen();
 
+static uint64_t quantum = CONFIG_DEVICE_QUANTUM;
+
+void set_device_quantum(uint64_t q) {
+  Assert(q > 0, "device quantum should be positive");
+  quantum = q;
+}
+
+// number of instructions the CPU can run before device_update() is called
+uint64_t device_quantum() {
+#ifdef CONFIG_ICOUNT
+  // stop exactly at the next alarm, but run at least one instruction
+  uint64_t remaining = alarm_remaining();
+  if (remaining < quantum) return (remaining > 0 ? remaining : 1);
+#endif
+  return quantum;
+}
+
 void device_update() {
+  IFDEF(CONFIG_ICOUNT, alarm_update());
+
   static uint64_t last = 0;
-  uint64_t now = get_time();
+  uint64_t now = get_guest_time();
   if (now - last < 1000000 / TIMER_HZ) {
     return;
   }
   last = now;
 
+  IFDEF(CONFIG_SMP, device_lock());
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
 
 #ifndef CONFIG_TARGET_AM
@@ -64,6 +85,7 @@ void device_update() {
     }
   }
 #endif
+  IFDEF(CONFIG_SMP, device_unlock());
 }
 
 void sdl_clear_event_queue() {
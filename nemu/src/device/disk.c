@@ -14,6 +14,77 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BLKSZ 512
+
+enum {
+  reg_blksz,
+  reg_blkcnt,
+  reg_buf,    // guest physical address of the buffer
+  reg_blkno,
+  reg_count,  // number of blocks to transfer
+  reg_cmd,    // a transfer starts when a command is written
+  reg_status,
+  nr_reg
+};
+
+enum { DISK_CMD_NONE, DISK_CMD_READ, DISK_CMD_WRITE };
+enum { DISK_OK, DISK_ERROR };
+
+static uint32_t *disk_base = NULL;
+static int disk_fd = -1;
+
+// the whole transfer is done with a single system call on pmem
+static bool disk_transfer(bool is_write) {
+  paddr_t buf = disk_base[reg_buf];
+  uint64_t blkno = disk_base[reg_blkno], count = disk_base[reg_count];
+  size_t len = count * BLKSZ;
+  off_t pos = blkno * BLKSZ;
+  if (disk_fd < 0 || blkno + count > disk_base[reg_blkcnt]) return false;
+  if (len == 0) return true;
+  if (!in_pmem(buf) || (uint64_t)buf - CONFIG_MBASE + len > CONFIG_MSIZE) return false;
+
+  uint8_t *p = guest_to_host(buf);
+  pmem_populate(buf, len);
+  if (is_write) return pwrite(disk_fd, p, len, pos) == (ssize_t)len;
+
+  pmem_invalidate(buf, len);
+  ssize_t n = pread(disk_fd, p, len, pos);
+  if (n < 0) return false;
+  // the last block may be beyond the end of the image
+  memset(p + n, 0, len - n);
+  return true;
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset != reg_cmd * sizeof(uint32_t)) return;
+  uint32_t cmd = disk_base[reg_cmd];
+  if (cmd == DISK_CMD_NONE) return;
+  bool ok = (cmd == DISK_CMD_READ || cmd == DISK_CMD_WRITE) && disk_transfer(cmd == DISK_CMD_WRITE);
+  disk_base[reg_status] = (ok ? DISK_OK : DISK_ERROR);
+  disk_base[reg_cmd] = DISK_CMD_NONE;
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+  disk_base[reg_blksz] = BLKSZ;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler, IOMAP_IO);
+#endif
+
+  const char *img = CONFIG_DISK_IMG_PATH;
+  if (img[0] == '\0') return;
+  disk_fd = open(img, O_RDWR);
+  Assert(disk_fd >= 0, "Can not open '%s'", img);
+  struct stat st;
+  fstat(disk_fd, &st);
+  disk_base[reg_blkcnt] = (st.st_size + BLKSZ - 1) / BLKSZ;
+  Log("Disk image %s, %u blocks", img, disk_base[reg_blkcnt]);
 }
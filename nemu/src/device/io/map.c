@@ -20,8 +20,17 @@
 
 #define IO_SPACE_MAX (2 * 1024 * 1024)
 
+#ifdef CONFIG_SMP
+#include <pthread.h>
+
+static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
+void device_lock()   { pthread_mutex_lock(&device_mutex); }
+void device_unlock() { pthread_mutex_unlock(&device_mutex); }
+#endif
+
 static uint8_t *io_space = NULL;
 static uint8_t *p_space = NULL;
+static uint8_t io_dirty[IO_SPACE_MAX / PAGE_SIZE] = {};
 
 uint8_t* new_space(int size) {
   uint8_t *p = p_space;
@@ -32,14 +41,25 @@ uint8_t* new_space(int size) {
   return p;
 }
 
-static void check_bound(IOMap *map, paddr_t addr) {
-  if (map == NULL) {
-    Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
-  } else {
-    Assert(addr <= map->high && addr >= map->low,
-        "address (" FMT_PADDR ") is out of bound {%s} [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
-        addr, map->name, map->low, map->high, cpu.pc);
+// the map is found by the address, so it is inside the map if it exists
+void io_space_set_dirty(uint8_t *p, int len) {
+  io_dirty[(p - io_space) >> PAGE_SHIFT] = 1;
+  io_dirty[(p + len - 1 - io_space) >> PAGE_SHIFT] = 1;
+}
+
+bool io_space_test_and_clean(uint8_t *p, uint32_t len) {
+  assert(p >= io_space && p + len <= io_space + IO_SPACE_MAX);
+  bool dirty = false;
+  size_t i;
+  for (i = (p - io_space) >> PAGE_SHIFT; i <= (p + len - 1 - io_space) >> PAGE_SHIFT; i ++) {
+    dirty |= io_dirty[i];
+    io_dirty[i] = 0;
   }
+  return dirty;
+}
+
+static void check_bound(IOMap *map, paddr_t addr) {
+  Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
 }
 
 static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_write) {
@@ -47,8 +67,10 @@ static void invoke_callback(io_callback_t c, paddr_t offset, int len, bool is_wr
 }
 
 void init_map() {
-  io_space = malloc(IO_SPACE_MAX);
+  // page aligned, so that the pages of RAM maps can be accessed by their host addresses
+  io_space = malloc(IO_SPACE_MAX + PAGE_SIZE);
   assert(io_space);
+  io_space = (uint8_t *)ROUNDUP(io_space, PAGE_SIZE);
   p_space = io_space;
 }
 
@@ -56,8 +78,10 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_SMP, device_lock());
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
+  IFDEF(CONFIG_SMP, device_unlock());
   return ret;
 }
 
@@ -65,6 +89,8 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
   check_bound(map, addr);
   paddr_t offset = addr - map->low;
+  IFDEF(CONFIG_SMP, device_lock());
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
+  IFDEF(CONFIG_SMP, device_unlock());
 }
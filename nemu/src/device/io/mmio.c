@@ -14,16 +14,44 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 
-#define NR_MAP 16
+/* MMIO maps are found by a two-level table indexed by the physical page
+ * number. A page may be shared by several small maps, they are chained
+ * from the slot of the page. Only the low 4GiB can be mapped. */
+#define L2_BITS 10
+#define L1_BITS (32 - PAGE_SHIFT - L2_BITS)
+#define L2_SIZE (1 << L2_BITS)
 
-static IOMap maps[NR_MAP] = {};
-static int nr_map = 0;
+typedef struct MMIOSlot {
+  IOMap *map;
+  struct MMIOSlot *next;
+} MMIOSlot;
+
+static MMIOSlot *mmio_table[1 << L1_BITS] = {};
+
+static inline MMIOSlot* fetch_slot(paddr_t addr, bool alloc) {
+  MMIOSlot **l2 = &mmio_table[addr >> (PAGE_SHIFT + L2_BITS)];
+  if (*l2 == NULL) {
+    if (!alloc) return NULL;
+    *l2 = calloc(L2_SIZE, sizeof(MMIOSlot));
+    assert(*l2);
+  }
+  return &(*l2)[(addr >> PAGE_SHIFT) & (L2_SIZE - 1)];
+}
 
 static IOMap* fetch_mmio_map(paddr_t addr) {
-  int mapid = find_mapid_by_addr(maps, nr_map, addr);
-  return (mapid == -1 ? NULL : &maps[mapid]);
+  if (MUXDEF(PMEM64, (addr >> 32) != 0, false)) return NULL;
+  MMIOSlot *s = fetch_slot(addr, false);
+  for (; s != NULL && s->map != NULL; s = s->next) {
+    if (map_inside(s->map, addr)) {
+      difftest_skip_ref();
+      return s->map;
+    }
+  }
+  return NULL;
 }
 
 static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
@@ -33,31 +61,65 @@ static void report_mmio_overlap(const char *name1, paddr_t l1, paddr_t r1,
 }
 
 /* device interface */
-void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback) {
-  assert(nr_map < NR_MAP);
+void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_callback_t callback, int type) {
   paddr_t left = addr, right = addr + len - 1;
   if (in_pmem(left) || in_pmem(right)) {
     report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
   }
-  for (int i = 0; i < nr_map; i++) {
-    if (left <= maps[i].high && right >= maps[i].low) {
-      report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
+  Assert(MUXDEF(PMEM64, (right >> 32) == 0, true) && left <= right,
+      "MMIO region %s@[" FMT_PADDR ", " FMT_PADDR "] is not in the low 4GiB", name, left, right);
+
+  IOMap *map = malloc(sizeof(IOMap));
+  assert(map);
+  *map = (IOMap){ .name = name, .low = left, .high = right, .space = space,
+    .callback = callback, .type = type };
+  // pages of RAM maps are accessed by host address, so they should be aligned as in new_space()
+  Assert(type != IOMAP_RAM || (callback == NULL && ((uintptr_t)space & PAGE_MASK) == (left & PAGE_MASK)),
+      "MMIO region %s is not a valid RAM map", name);
+
+  paddr_t pn;
+  for (pn = left >> PAGE_SHIFT; pn <= (right >> PAGE_SHIFT); pn ++) {
+    MMIOSlot *slot = fetch_slot(pn << PAGE_SHIFT, true), *s;
+    for (s = slot; s != NULL && s->map != NULL; s = s->next) {
+      if (left <= s->map->high && right >= s->map->low) {
+        report_mmio_overlap(name, left, right, s->map->name, s->map->low, s->map->high);
+      }
+    }
+    if (slot->map != NULL) {
+      MMIOSlot *old = malloc(sizeof(MMIOSlot));
+      assert(old);
+      *old = *slot;
+      slot->next = old;
     }
+    slot->map = map;
   }
 
-  maps[nr_map] = (IOMap){ .name = name, .low = addr, .high = addr + len - 1,
-    .space = space, .callback = callback };
-  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]",
-      maps[nr_map].name, maps[nr_map].low, maps[nr_map].high);
+  Log("Add mmio map '%s' at [" FMT_PADDR ", " FMT_PADDR "]%s", map->name, map->low, map->high,
+      (type == IOMAP_RAM ? " as RAM" : ""));
+}
 
-  nr_map ++;
+uint8_t* mmio_ram_page(paddr_t pg) {
+  IOMap *map = fetch_mmio_map(pg);
+  if (map == NULL || map->type != IOMAP_RAM || pg < map->low || pg + PAGE_SIZE - 1 > map->high) return NULL;
+  return (uint8_t *)map->space + (pg - map->low);
 }
 
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  IOMap *map = fetch_mmio_map(addr);
+  if (map != NULL && map->type == IOMAP_RAM) {
+    return host_read((uint8_t *)map->space + (addr - map->low), len);
+  }
+  return map_read(addr, len, map);
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
-  map_write(addr, len, data, fetch_mmio_map(addr));
+  IOMap *map = fetch_mmio_map(addr);
+  if (map != NULL && map->type == IOMAP_RAM) {
+    uint8_t *p = (uint8_t *)map->space + (addr - map->low);
+    host_write(p, len, data);
+    io_space_set_dirty(p, len);
+    return;
+  }
+  map_write(addr, len, data, map);
 }
@@ -14,6 +14,10 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mmc.h"
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
@@ -40,10 +44,12 @@ enum {
   SDHBLC
 };
 
-static FILE *fp = NULL;
+// the image is mapped to memory, so that accessing SDDATA is only a copy
+static uint8_t *img = NULL;
+static uint64_t img_size = 0;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
-static long blk_addr = 0;
+static uint64_t blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
@@ -51,7 +57,6 @@ static bool read_ext_csd = false;
 static void prepare_rw(int is_write) {
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
 }
 
@@ -109,10 +114,12 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if (img) {
+         uint64_t pos = (blk_addr << 9) + addr;
+         if (pos + 4 <= img_size) {
+           if (!write_cmd) { memcpy(&base[SDDATA], img + pos, 4); }
+           else { memcpy(img + pos, &base[SDDATA], 4); }
+         }
        }
        addr += 4;
        break;
@@ -124,11 +131,21 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
 
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
-  add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
+  add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler, IOMAP_IO);
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  int fd = open(path, O_RDWR);
+  if (fd < 0) { Log("Can not find sdcard image: %s", path); return; }
+  struct stat st;
+  fstat(fd, &st);
+  img_size = st.st_size;
+  // an empty image can not be mapped, and it holds no data to access anyway
+  if (img_size > 0) {
+    // shared, so that the writes reach the image
+    img = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    Assert(img != MAP_FAILED, "Can not map sdcard image: %s", path);
+  }
+  close(fd);
 }
@@ -15,6 +15,7 @@
 
 #include <common.h>
 #include <device/map.h>
+#include <memory/vaddr.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
 #define SCREEN_H (MUXDEF(CONFIG_VGA_SIZE_800x600, 600, 300))
@@ -34,8 +35,64 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
-#ifdef CONFIG_VGA_SHOW_SCREEN
-#ifndef CONFIG_TARGET_AM
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+#ifdef CONFIG_VGA_CAPTURE
+#include <device/alarm.h>
+
+// each frame is converted row by row when its rows are uploaded, and
+// written out as a whole when presented
+static FILE *capture_fp = NULL;
+static bool capture_y4m = false;
+static uint8_t *frame = NULL;
+static uint64_t nr_frame = 0;
+
+static void init_screen() {
+  const char *file = CONFIG_VGA_CAPTURE_FILE;
+  size_t len = strlen(file);
+  capture_y4m = (len >= 4 && strcmp(file + len - 4, ".y4m") == 0);
+  capture_fp = fopen(file, "w");
+  Assert(capture_fp, "Can not open '%s'", file);
+  frame = malloc(SCREEN_W * SCREEN_H * 3);
+  assert(frame);
+  if (capture_y4m) {
+    // device updates happen at most TIMER_HZ times per second
+    fprintf(capture_fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+        SCREEN_W, SCREEN_H, TIMER_HZ, CONFIG_VGA_CAPTURE_DECIMATE);
+  }
+  Log("Capturing the screen to %s", file);
+}
+
+static inline void update_rows(uint32_t y, uint32_t h) {
+  const uint32_t npixel = SCREEN_W * SCREEN_H;
+  uint32_t *src = (uint32_t *)vmem + y * SCREEN_W;
+  uint32_t i, n = h * SCREEN_W;
+  if (capture_y4m) {
+    // planar YCbCr 4:4:4, BT.601 limited range
+    uint8_t *p = frame + y * SCREEN_W;
+    for (i = 0; i < n; i ++) {
+      int r = (src[i] >> 16) & 0xff, g = (src[i] >> 8) & 0xff, b = src[i] & 0xff;
+      p[i]              = ((  66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+      p[i + npixel]     = ((- 38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+      p[i + npixel * 2] = (( 112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+    }
+  } else {
+    uint8_t *p = frame + y * SCREEN_W * 3;
+    for (i = 0; i < n; i ++) {
+      p[i * 3 + 0] = src[i] >> 16;
+      p[i * 3 + 1] = src[i] >> 8;
+      p[i * 3 + 2] = src[i];
+    }
+  }
+}
+
+static inline void present() {
+  if (nr_frame ++ % CONFIG_VGA_CAPTURE_DECIMATE != 0) return;
+  if (capture_y4m) fputs("FRAME\n", capture_fp);
+  else fprintf(capture_fp, "P6\n%d %d\n255\n", SCREEN_W, SCREEN_H);
+  fwrite(frame, 1, SCREEN_W * SCREEN_H * 3, capture_fp);
+  fflush(capture_fp);
+}
+#elif !defined(CONFIG_TARGET_AM)
 #include <SDL2/SDL.h>
 
 static SDL_Renderer *renderer = NULL;
@@ -56,8 +113,12 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static inline void update_rows(uint32_t y, uint32_t h) {
+  SDL_Rect rect = { .x = 0, .y = y, .w = SCREEN_W, .h = h };
+  SDL_UpdateTexture(texture, &rect, (uint32_t *)vmem + y * SCREEN_W, SCREEN_W * sizeof(uint32_t));
+}
+
+static inline void present() {
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -65,15 +126,47 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static inline void update_rows(uint32_t y, uint32_t h) {
+  io_write(AM_GPU_FBDRAW, 0, y, (uint32_t *)vmem + y * screen_width(), screen_width(), h, false);
+}
+
+static inline void present() {
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
 }
 #endif
+
+static bool redraw_all = true;
+
+// only upload the rows in the pages of vmem written since the last update
+static void update_screen() {
+  uint32_t pitch = screen_width() * sizeof(uint32_t), size = screen_size();
+  uint32_t y0 = 0, y1 = 0; // the band of dirty rows [y0, y1) to upload
+  uint32_t off;
+  for (off = 0; off < size; off += PAGE_SIZE) {
+    uint32_t len = (size - off < PAGE_SIZE ? size - off : PAGE_SIZE);
+    bool dirty = io_space_test_and_clean((uint8_t *)vmem + off, len);
+    if (!dirty && !redraw_all) continue;
+    uint32_t r0 = off / pitch, r1 = (off + len - 1) / pitch + 1;
+    if (r0 > y1) {
+      if (y1 > y0) update_rows(y0, y1 - y0);
+      y0 = r0;
+    }
+    y1 = r1;
+  }
+  redraw_all = false;
+  if (y1 == y0) return; // nothing changed
+  update_rows(y0, y1 - y0);
+  present();
+}
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (vgactl_port_base[1] != 0) {
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+    update_screen();
+#endif
+    vgactl_port_base[1] = 0;
+  }
 }
 
 void init_vga() {
@@ -82,11 +175,13 @@ void init_vga() {
 #ifdef CONFIG_HAS_PORT_IO
   add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL, IOMAP_IO);
 #endif
 
   vmem = new_space(screen_size());
-  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL, IOMAP_RAM);
+#if defined(CONFIG_VGA_SHOW_SCREEN) || defined(CONFIG_VGA_CAPTURE)
+  init_screen();
+  memset(vmem, 0, screen_size());
+#endif
 }
@@ -0,0 +1,111 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <memory/paddr.h>
+#include "block.h"
+
+#define MAX_BLOCK_INST 64
+#define BLOCK_HASH_SIZE 4096
+#define BLOCK_POOL_SIZE (8 * 1024 * 1024)
+#define MAX_BLOCK_SIZE (sizeof(Block) + MAX_BLOCK_INST * sizeof(ICacheEntry))
+
+static Block *htable[BLOCK_HASH_SIZE] = {};
+static uint8_t block_pool[BLOCK_POOL_SIZE] __attribute__((aligned(16)));
+static uint8_t *pool_top = block_pool;
+uint64_t code_map[(CONFIG_MSIZE >> CODE_LINE_SHIFT) / 64] = {};
+uint64_t block_gen = 0;
+
+static inline bool is_code(paddr_t addr) {
+  if (!in_pmem(addr)) return false;
+  paddr_t line = (addr - CONFIG_MBASE) >> CODE_LINE_SHIFT;
+  return (code_map[line / 64] >> (line % 64)) & 1;
+}
+
+static inline void mark_code(paddr_t addr) {
+  paddr_t line = (addr - CONFIG_MBASE) >> CODE_LINE_SHIFT;
+  code_map[line / 64] |= 1ull << (line % 64);
+}
+
+static inline int hash(vaddr_t pc) {
+  return (pc >> 2) & (BLOCK_HASH_SIZE - 1);
+}
+
+void block_flush() {
+  memset(htable, 0, sizeof(htable));
+  memset(code_map, 0, sizeof(code_map));
+  // stores to unmarked lines may skip icache_invalidate(),
+  // so no decoded instruction should survive its mark
+  icache_flush();
+  pool_top = block_pool;
+  block_gen ++;
+}
+
+Block* block_lookup(vaddr_t pc) {
+  Block *b;
+  for (b = htable[hash(pc)]; b != NULL; b = b->hnext) {
+    if (b->pc == pc) return b;
+  }
+  return NULL;
+}
+
+// The space is reserved for the longest block, and
+// the unused part is given back by block_commit().
+Block* block_new(vaddr_t pc) {
+  if (pool_top + MAX_BLOCK_SIZE > block_pool + BLOCK_POOL_SIZE) block_flush();
+  Block *b = (Block *)pool_top;
+  *b = (Block) { .pc = pc, .end = pc };
+  return b;
+}
+
+// append the instruction at `pc', which should be just executed
+bool block_append(Block *b, vaddr_t pc) {
+  ICacheEntry *e = icache_entry(pc);
+  if (e->tag != (pc | 1) || !in_pmem(pc)) return false;
+  // Also mark the instructions left out of a full block, since they are
+  // still in the icache. Stores to unmarked lines can then skip
+  // icache_invalidate(), which is what the JIT engine relies on.
+  mark_code(pc);
+  if (b->nr_inst == MAX_BLOCK_INST || pc != b->end) return false;
+  b->inst[b->nr_inst ++] = *e;
+  b->end = e->snpc;
+  return true;
+}
+
+void block_commit(Block *b) {
+  if (b->nr_inst == 0) return;
+  pool_top += ROUNDUP(sizeof(Block) + b->nr_inst * sizeof(ICacheEntry), 16);
+  int idx = hash(b->pc);
+  b->hnext = htable[idx];
+  htable[idx] = b;
+}
+
+// called on every store to throw away the blocks which may be modified
+void block_invalidate(paddr_t addr, int len) {
+  if (is_code(addr) || is_code(addr + len - 1)) {
+    block_flush();
+  }
+}
+
+// the same for a write of any length in pmem, such as DMA
+void block_invalidate_range(paddr_t addr, size_t len) {
+  paddr_t first = (addr - CONFIG_MBASE) >> CODE_LINE_SHIFT;
+  paddr_t last = (addr + len - 1 - CONFIG_MBASE) >> CODE_LINE_SHIFT;
+  for (paddr_t line = first; line <= last; line ++) {
+    if ((code_map[line / 64] >> (line % 64)) & 1) {
+      block_flush();
+      return;
+    }
+  }
+}
@@ -0,0 +1,57 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __ENGINE_BLOCK_H__
+#define __ENGINE_BLOCK_H__
+
+#include <cpu/decode.h>
+
+typedef struct Block {
+  vaddr_t pc;  // pc of the first instruction
+  vaddr_t end; // static next pc of the last instruction
+  int nr_inst;
+  struct Block *hnext;   // next block in the same hash bucket
+  struct Block *succ[2]; // chained successors, [0] for falling through, [1] for jumping
+#ifdef CONFIG_ENGINE_JIT
+  void *code;       // translated host code
+  uint32_t nr_exec; // number of executions before translated
+#endif
+  ICacheEntry inst[];
+} Block;
+
+// bumped whenever all blocks are thrown away
+extern uint64_t block_gen;
+// bitmap of the memory lines containing instructions of some block, marked
+// by pc and checked by the physical address of stores, see icache_invalidate()
+#define CODE_LINE_SHIFT 6
+extern uint64_t code_map[];
+
+Block* block_lookup(vaddr_t pc);
+Block* block_new(vaddr_t pc);
+bool block_append(Block *b, vaddr_t pc);
+void block_commit(Block *b);
+void block_flush();
+
+// find the block starting at `pc' which is executed after `b', and patch the link
+static inline Block* block_chain(Block *b, vaddr_t pc) {
+  int k = (pc != b->end);
+  Block *next = b->succ[k];
+  if (likely(next != NULL && next->pc == pc)) return next;
+  next = block_lookup(pc);
+  if (next != NULL) b->succ[k] = next;
+  return next;
+}
+
+#endif
@@ -0,0 +1,329 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include "jit.h"
+
+#ifndef __x86_64__
+#error "the JIT engine only generates x86-64 code"
+#endif
+
+#define CODE_CACHE_SIZE (16 * 1024 * 1024)
+#define MAX_CODE_PER_INST 256
+#define JIT_THRESHOLD 16
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_B = 0x2, CC_AE = 0x3, CC_Z = 0x4, CC_NZ = 0x5 };
+
+/* Register usage of the host code:
+ *   rbp        - always points to `cpu'
+ *   rbx, r12-15 - keep the guest registers most used by the block
+ *   others     - scratch
+ * The cached guest registers are written back to `cpu.gpr' before
+ * calling into C and when leaving the host code.
+ */
+#define NR_CACHED_GPR 5
+static const int cached_host[NR_CACHED_GPR] = { RBX, R12, R13, R14, R15 };
+static int guest_of[NR_CACHED_GPR]; // guest register kept in a host register, 0 if unused
+static int host_of[32];             // host register keeping a guest register, -1 if none
+
+static uint8_t *code_base = NULL, *code_top = NULL;
+static uint64_t code_gen = 0; // block_gen when the code cache is filled
+static uint64_t run_gen = 0;  // block_gen when the host code is entered
+static uint8_t *p = NULL;     // where to emit the next byte
+
+#define GPR_OFF(i) (offsetof(CPU_state, gpr) + (i) * sizeof(word_t))
+#define PC_OFF offsetof(CPU_state, pc)
+
+// x86-64 encoding
+
+static void emit8(uint8_t x) { *p ++ = x; }
+static void emit32(uint32_t x) { memcpy(p, &x, 4); p += 4; }
+static void emit64(uint64_t x) { memcpy(p, &x, 8); p += 8; }
+
+// the REX prefix is omitted if no bit is set
+static void rex(int w, int reg, int index, int base) {
+  uint8_t x = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+  if (x != 0x40) emit8(x);
+}
+
+static void modrm_reg(int reg, int rm) { emit8(0xc0 | ((reg & 7) << 3) | (rm & 7)); }
+// [rbp + off]
+static void modrm_cpu(int reg, uint32_t off) { emit8(0x80 | ((reg & 7) << 3) | RBP); emit32(off); }
+// [base + index], `base' can not be rbp or r13
+static void modrm_sib(int reg, int base, int index) {
+  emit8(((reg & 7) << 3) | 4);
+  emit8(((index & 7) << 3) | (base & 7));
+}
+
+static void mov_rr(int dst, int src) { rex(0, src, 0, dst); emit8(0x89); modrm_reg(src, dst); }
+static void mov_ri(int dst, uint32_t imm) { rex(0, 0, 0, dst); emit8(0xb8 | (dst & 7)); emit32(imm); }
+static void mov_ri64(int dst, uint64_t imm) { rex(1, 0, 0, dst); emit8(0xb8 | (dst & 7)); emit64(imm); }
+static void xor_rr(int dst, int src) { rex(0, src, 0, dst); emit8(0x31); modrm_reg(src, dst); }
+static void test_rr(int dst, int src) { rex(0, src, 0, dst); emit8(0x85); modrm_reg(src, dst); }
+static void alu_ri(int op, int dst, uint32_t imm) { rex(0, 0, 0, dst); emit8(0x81); modrm_reg(op, dst); emit32(imm); }
+#define add_ri(dst, imm) alu_ri(0, dst, imm)
+#define cmp_ri(dst, imm) alu_ri(7, dst, imm)
+static void shr_ri(int dst, uint8_t imm) { rex(0, 0, 0, dst); emit8(0xc1); modrm_reg(5, dst); emit8(imm); }
+static void load_cpu(int dst, uint32_t off) { rex(0, dst, 0, RBP); emit8(0x8b); modrm_cpu(dst, off); }
+static void store_cpu(uint32_t off, int src) { rex(0, src, 0, RBP); emit8(0x89); modrm_cpu(src, off); }
+static void store_cpu_imm(uint32_t off, uint32_t imm) { emit8(0xc7); modrm_cpu(0, off); emit32(imm); }
+static void push(int r) { rex(0, 0, 0, r); emit8(0x50 | (r & 7)); }
+static void pop(int r) { rex(0, 0, 0, r); emit8(0x58 | (r & 7)); }
+static void call(void *f) { mov_ri64(RAX, (uintptr_t)f); emit8(0xff); modrm_reg(2, RAX); }
+
+// forward jumps return the end of the jump instruction, which is fixed by patch()
+static uint8_t* jcc(int cc) { emit8(0x0f); emit8(0x80 | cc); emit32(0); return p; }
+static uint8_t* jmp() { emit8(0xe9); emit32(0); return p; }
+static void jmp_to(uint8_t *target) { emit8(0xe9); emit32(target - (p + 4)); }
+static void patch(uint8_t *end) { uint32_t rel = p - end; memcpy(end - 4, &rel, 4); }
+
+// guest registers
+
+static void read_gpr(int host, int gpr) {
+  if (gpr == 0) xor_rr(host, host);
+  else if (host_of[gpr] >= 0) mov_rr(host, host_of[gpr]);
+  else load_cpu(host, GPR_OFF(gpr));
+}
+
+static void write_gpr(int gpr, int host) {
+  if (gpr == 0) return;
+  if (host_of[gpr] >= 0) mov_rr(host_of[gpr], host);
+  else store_cpu(GPR_OFF(gpr), host);
+}
+
+static void write_gpr_imm(int gpr, uint32_t imm) {
+  if (gpr == 0) return;
+  if (host_of[gpr] >= 0) mov_ri(host_of[gpr], imm);
+  else store_cpu_imm(GPR_OFF(gpr), imm);
+}
+
+static void spill() {
+  for (int i = 0; i < NR_CACHED_GPR; i ++) {
+    if (guest_of[i] != 0) store_cpu(GPR_OFF(guest_of[i]), cached_host[i]);
+  }
+}
+
+static void reload() {
+  for (int i = 0; i < NR_CACHED_GPR; i ++) {
+    if (guest_of[i] != 0) load_cpu(cached_host[i], GPR_OFF(guest_of[i]));
+  }
+}
+
+// helpers called by the host code
+
+static word_t helper_load(vaddr_t addr, int len) {
+  return vaddr_read(addr, len);
+}
+
+// return whether the execution can go on
+static int helper_store(vaddr_t addr, int len, word_t data) {
+  vaddr_write(addr, len, data);
+  return block_gen == run_gen;
+}
+
+static int helper_exec(const ICacheEntry *e, vaddr_t pc) {
+  Decode s;
+  s.pc = pc;
+  s.snpc = e->snpc;
+  s.isa = e->isa;
+  s.handler = e->handler;
+  isa_exec_decoded(&s);
+  cpu.pc = s.dnpc;
+  return s.dnpc == s.snpc && nemu_state.state == NEMU_RUNNING && block_gen == run_gen;
+}
+
+// translation
+
+/* Instructions translated into host code. They should be kept in sync with
+ * the INSTPAT table in isa/riscv32/inst.c. All others are executed by the
+ * interpreter through helper_exec().
+ */
+enum { JIT_AUIPC, JIT_LBU, JIT_SB, JIT_HELPER };
+
+static int classify(uint32_t i) {
+  switch (BITS(i, 6, 0)) {
+    case 0x17: return JIT_AUIPC;
+    case 0x03: return (BITS(i, 14, 12) == 4 ? JIT_LBU : JIT_HELPER);
+    case 0x23: return (BITS(i, 14, 12) == 0 ? JIT_SB : JIT_HELPER);
+  }
+  return JIT_HELPER;
+}
+
+// keep the most used guest registers of `b' in host registers
+static void alloc_gpr(Block *b) {
+  int count[32] = {};
+  for (int i = 0; i < b->nr_inst; i ++) {
+    ISADecodeInfo *d = &b->inst[i].isa;
+    switch (classify(d->inst.val)) {
+      case JIT_AUIPC: count[d->rd] ++; break;
+      case JIT_LBU:   count[d->rs1] ++; count[d->rd] ++; break;
+      case JIT_SB:    count[d->rs1] ++; count[d->rs2] ++; break;
+    }
+  }
+  count[0] = 0;
+  memset(host_of, -1, sizeof(host_of));
+  for (int k = 0; k < NR_CACHED_GPR; k ++) {
+    int best = 0;
+    for (int i = 1; i < 32; i ++) {
+      if (count[i] > count[best]) best = i;
+    }
+    guest_of[k] = best;
+    if (best != 0) {
+      host_of[best] = cached_host[k];
+      count[best] = 0;
+    }
+  }
+}
+
+// rcx holds the guest address, leave the offset into pmem in rax
+static uint8_t* gen_pmem_check() {
+  mov_rr(RAX, RCX);
+  add_ri(RAX, -(uint32_t)CONFIG_MBASE);
+  cmp_ri(RAX, CONFIG_MSIZE);
+  return jcc(CC_AE);
+}
+
+static void gen_lbu(vaddr_t pc, ISADecodeInfo *d) {
+  read_gpr(RCX, d->rs1);
+  add_ri(RCX, d->imm);
+  uint8_t *slow = gen_pmem_check();
+  mov_ri64(RDX, (uintptr_t)guest_to_host(CONFIG_MBASE));
+  rex(0, RAX, RAX, RDX); emit8(0x0f); emit8(0xb6); modrm_sib(RAX, RDX, RAX); // movzx eax, byte [rdx + rax]
+  uint8_t *done = jmp();
+  patch(slow);
+  store_cpu_imm(PC_OFF, pc);
+  spill();
+  mov_rr(RDI, RCX);
+  mov_ri(RSI, 1);
+  call(helper_load);
+  patch(done);
+  write_gpr(d->rd, RAX);
+}
+
+static void gen_sb(int idx, vaddr_t pc, vaddr_t snpc, ISADecodeInfo *d, uint8_t *exit) {
+  read_gpr(RCX, d->rs1);
+  add_ri(RCX, d->imm);
+  read_gpr(R8, d->rs2);
+  uint8_t *slow = gen_pmem_check();
+  // stores to code go through the slow path to throw away the blocks
+  mov_rr(R10, RAX);
+  shr_ri(R10, CODE_LINE_SHIFT);
+  mov_ri64(R9, (uintptr_t)code_map);
+  rex(0, R10, 0, R9); emit8(0x0f); emit8(0xa3); emit8(((R10 & 7) << 3) | (R9 & 7)); // bt [r9], r10d
+  uint8_t *slow_code = jcc(CC_B);
+  mov_ri64(R9, (uintptr_t)guest_to_host(CONFIG_MBASE));
+  rex(0, R8, RAX, R9); emit8(0x88); modrm_sib(R8, R9, RAX); // mov [r9 + rax], r8b
+  uint8_t *done = jmp();
+  patch(slow);
+  patch(slow_code);
+  store_cpu_imm(PC_OFF, pc);
+  spill();
+  mov_rr(RDI, RCX);
+  mov_ri(RSI, 1);
+  mov_rr(RDX, R8);
+  call(helper_store);
+  test_rr(RAX, RAX);
+  uint8_t *cont = jcc(CC_NZ);
+  store_cpu_imm(PC_OFF, snpc);
+  mov_ri(RAX, idx + 1);
+  jmp_to(exit);
+  patch(cont);
+  patch(done);
+}
+
+static void gen_helper(int idx, vaddr_t pc, ICacheEntry *e, uint8_t *exit) {
+  spill();
+  mov_ri64(RDI, (uintptr_t)e);
+  mov_ri(RSI, pc);
+  call(helper_exec);
+  reload();
+  test_rr(RAX, RAX);
+  uint8_t *cont = jcc(CC_NZ);
+  mov_ri(RAX, idx + 1);
+  jmp_to(exit);
+  patch(cont);
+}
+
+static void* translate(Block *b) {
+  if (code_base == NULL) {
+    code_base = mmap(NULL, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Assert(code_base != MAP_FAILED, "fail to allocate the code cache");
+    code_top = code_base;
+  }
+  if (code_gen != block_gen) {
+    code_top = code_base;
+    code_gen = block_gen;
+  }
+  size_t size = MAX_CODE_PER_INST * (b->nr_inst + 1);
+  if (code_top + size > code_base + CODE_CACHE_SIZE) {
+    // start over, the caller should drop `b' as it is flushed
+    block_flush();
+    return NULL;
+  }
+
+  alloc_gpr(b);
+  p = code_top;
+
+  // the exit shared by the whole block, with the number of executed instructions in eax
+  uint8_t *exit = p;
+  spill();
+  emit8(0x48); emit8(0x83); emit8(0xc4); emit8(0x08); // add rsp, 8
+  pop(R15); pop(R14); pop(R13); pop(R12); pop(RBX); pop(RBP);
+  emit8(0xc3); // ret
+
+  void *entry = p;
+  push(RBP); push(RBX); push(R12); push(R13); push(R14); push(R15);
+  emit8(0x48); emit8(0x83); emit8(0xec); emit8(0x08); // sub rsp, 8, to align the stack for calls
+  mov_ri64(RBP, (uintptr_t)&cpu);
+  reload();
+
+  vaddr_t pc = b->pc;
+  for (int i = 0; i < b->nr_inst; i ++) {
+    ICacheEntry *e = &b->inst[i];
+    switch (classify(e->isa.inst.val)) {
+      case JIT_AUIPC: write_gpr_imm(e->isa.rd, pc + e->isa.imm); break;
+      case JIT_LBU:   gen_lbu(pc, &e->isa); break;
+      case JIT_SB:    gen_sb(i, pc, e->snpc, &e->isa, exit); break;
+      default:        gen_helper(i, pc, e, exit); break;
+    }
+    pc = e->snpc;
+  }
+  store_cpu_imm(PC_OFF, b->end);
+  mov_ri(RAX, b->nr_inst);
+  jmp_to(exit);
+
+  Assert(p <= code_top + size, "host code of block at " FMT_WORD " overflows", b->pc);
+  code_top = (uint8_t *)ROUNDUP((uintptr_t)p, 16);
+  return entry;
+}
+
+void* jit_code(Block *b) {
+  if (b->code == NULL && ++ b->nr_exec >= JIT_THRESHOLD) {
+    b->code = translate(b);
+  }
+  return b->code;
+}
+
+uint32_t jit_run(Block *b) {
+  run_gen = block_gen;
+  return ((uint32_t (*)())b->code)();
+}
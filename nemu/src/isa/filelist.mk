@@ -15,3 +15,22 @@
 
 INC_PATH += $(NEMU_HOME)/src/isa/$(GUEST_ISA)/include
 DIRS-y += src/isa/$(GUEST_ISA)
+
+ifdef CONFIG_DECODE_TREE
+GEN_DECODE_PATH := $(NEMU_HOME)/tools/gen-decode
+GEN_DECODE := $(GEN_DECODE_PATH)/build/gen-decode
+DECODE_TREE_DIR := $(NEMU_HOME)/build/gen-$(GUEST_ISA)
+INC_PATH += $(DECODE_TREE_DIR)
+
+$(GEN_DECODE):
+	@$(MAKE) -s -C $(GEN_DECODE_PATH)
+
+$(DECODE_TREE_DIR)/decode-tree.h: src/isa/$(GUEST_ISA)/inst.c $(GEN_DECODE)
+	@echo + GEN $@
+	@mkdir -p $(dir $@)
+	@$(GEN_DECODE) $< > $@.tmp
+	@mv $@.tmp $@
+
+# the header should be ready before inst.c is compiled for the first time
+$(NEMU_HOME)/build/obj-$(NAME)$(if $(CONFIG_TARGET_SHARE),-so)/src/isa/$(GUEST_ISA)/inst.o: $(DECODE_TREE_DIR)/decode-tree.h
+endif
@@ -21,6 +21,13 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  word_t mhartid;
+  word_t satp;
+  struct {
+    bool valid;
+    paddr_t addr;
+    uint32_t val; // memory value seen by lr.w
+  } resv; // reservation for lr.w/sc.w
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
@@ -28,8 +35,23 @@ typedef struct {
   union {
     uint32_t val;
   } inst;
+  // operands extracted by decode_operand()
+  int rd, rs1, rs2;
+  word_t imm;
+#ifdef CONFIG_FUSION
+  int fuse; // kind of the superinstruction led by this instruction
+  struct {
+    int rd, rs2;
+    vaddr_t addr;
+  } fused; // operands of the second instruction
+#endif
 } MUXDEF(CONFIG_RV64, riscv64_ISADecodeInfo, riscv32_ISADecodeInfo);
 
+#ifdef CONFIG_RV_SV32
+// translate all accesses once satp.MODE is set, there are no privilege modes yet
+#define isa_mmu_check(vaddr, len, type) ((cpu.satp >> 31) ? MMU_TRANSLATE : MMU_DIRECT)
+#else
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+#endif
 
 #endif
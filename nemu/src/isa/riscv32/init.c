@@ -34,6 +34,15 @@ static void restart() {
   cpu.gpr[0] = 0;
 }
 
+#ifdef CONFIG_SMP
+// called on the host thread of hart `hartid', which starts at `pc'
+void isa_hart_init(int hartid, vaddr_t pc) {
+  restart();
+  cpu.pc = pc;
+  cpu.mhartid = hartid;
+}
+#endif
+
 void init_isa() {
   /* Load built-in image. */
   memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
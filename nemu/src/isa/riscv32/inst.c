@@ -17,34 +17,119 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#ifdef CONFIG_DECODE_TREE
+#include <decode-tree.h>
+#endif
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
 enum {
-  TYPE_I, TYPE_U, TYPE_S,
+  TYPE_R, TYPE_I, TYPE_U, TYPE_S,
   TYPE_N, // none
 };
 
-#define src1R() do { *src1 = R(rs1); } while (0)
-#define src2R() do { *src2 = R(rs2); } while (0)
-#define immI() do { *imm = SEXT(BITS(i, 31, 20), 12); } while(0)
-#define immU() do { *imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
-#define immS() do { *imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
+#define src1R() do { *src1 = R(s->isa.rs1); } while (0)
+#define src2R() do { *src2 = R(s->isa.rs2); } while (0)
+#define immI() do { s->isa.imm = SEXT(BITS(i, 31, 20), 12); } while(0)
+#define immU() do { s->isa.imm = SEXT(BITS(i, 31, 12), 20) << 12; } while(0)
+#define immS() do { s->isa.imm = (SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7); } while(0)
 
-static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+// extract register indices and immediate, the result can be cached
+static void decode_operand(Decode *s, int type) {
   uint32_t i = s->isa.inst.val;
-  int rs1 = BITS(i, 19, 15);
-  int rs2 = BITS(i, 24, 20);
-  *rd     = BITS(i, 11, 7);
+  s->isa.rs1 = BITS(i, 19, 15);
+  s->isa.rs2 = BITS(i, 24, 20);
+  s->isa.rd  = BITS(i, 11, 7);
   switch (type) {
-    case TYPE_I: src1R();          immI(); break;
-    case TYPE_U:                   immU(); break;
-    case TYPE_S: src1R(); src2R(); immS(); break;
+    case TYPE_I: immI(); break;
+    case TYPE_U: immU(); break;
+    case TYPE_S: immS(); break;
   }
 }
 
+// read the source registers, this should be done every time the instruction is executed
+static void read_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
+  *rd  = s->isa.rd;
+  *imm = s->isa.imm;
+  switch (type) {
+    case TYPE_R: src1R(); src2R(); break;
+    case TYPE_I: src1R();          break;
+    case TYPE_S: src1R(); src2R(); break;
+  }
+}
+
+// --- A extension ---
+/* With SMP, the other harts access the memory from other host threads,
+ * so AMOs and sc.w on pmem are done by host atomic operations on the
+ * translated address. sc.w
+ * succeeds if the memory still holds the value seen by lr.w.
+ */
+enum { AMO_SWAP, AMO_ADD, AMO_XOR, AMO_AND, AMO_OR, AMO_MIN, AMO_MAX, AMO_MINU, AMO_MAXU };
+
+static uint32_t amo_alu(int op, uint32_t a, uint32_t b) {
+  switch (op) {
+    case AMO_SWAP: return b;
+    case AMO_ADD:  return a + b;
+    case AMO_XOR:  return a ^ b;
+    case AMO_AND:  return a & b;
+    case AMO_OR:   return a | b;
+    case AMO_MIN:  return ((int32_t)a < (int32_t)b ? a : b);
+    case AMO_MAX:  return ((int32_t)a > (int32_t)b ? a : b);
+    case AMO_MINU: return (a < b ? a : b);
+    case AMO_MAXU: return (a > b ? a : b);
+    default: panic("bad AMO %d", op);
+  }
+}
+
+static word_t amo(vaddr_t addr, word_t src, int op) {
+  uint32_t old;
+#ifdef CONFIG_SMP
+  paddr_t paddr = vaddr_translate(addr, 4, MEM_TYPE_WRITE);
+  if (in_pmem(paddr)) {
+    uint32_t *p = (uint32_t *)guest_to_host(paddr);
+    old = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(p, &old, amo_alu(op, old, src),
+          true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return SEXT(old, 32);
+  }
+#endif
+  old = Mr(addr, 4);
+  Mw(addr, 4, amo_alu(op, old, src));
+  return SEXT(old, 32);
+}
+
+static word_t lr(vaddr_t addr) {
+  uint32_t val = Mr(addr, 4);
+  cpu.resv.valid = true;
+  cpu.resv.addr = addr;
+  cpu.resv.val = val;
+  return SEXT(val, 32);
+}
+
+// return 0 on success
+static word_t sc(vaddr_t addr, word_t src) {
+  bool ok = cpu.resv.valid && cpu.resv.addr == addr;
+  cpu.resv.valid = false;
+  if (!ok) return 1;
+#ifdef CONFIG_SMP
+  paddr_t paddr = vaddr_translate(addr, 4, MEM_TYPE_WRITE);
+  if (in_pmem(paddr)) {
+    uint32_t expected = cpu.resv.val;
+    return !__atomic_compare_exchange_n((uint32_t *)guest_to_host(paddr), &expected, src,
+        false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  }
+#endif
+  Mw(addr, 4, src);
+  return 0;
+}
+
+void isa_satp_write(word_t satp);
+void isa_sfence_vma(vaddr_t vaddr, bool all_vaddr, int asid, bool all_asid);
+
 static int decode_exec(Decode *s) {
   int rd = 0;
   word_t src1 = 0, src2 = 0, imm = 0;
@@ -52,15 +137,38 @@ static int decode_exec(Decode *s) {
 
 #define INSTPAT_INST(s) ((s)->isa.inst.val)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */ ) { \
-  decode_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  decode_operand(s, concat(TYPE_, type)); \
+  IFDEF(CONFIG_ICACHE, icache_fill(s, &&concat(__instpat_exec_, __LINE__)); \
+  concat(__instpat_exec_, __LINE__):) \
+  read_operand(s, &rd, &src1, &src2, &imm, concat(TYPE_, type)); \
+  INSTPAT_COUNT(name); \
   __VA_ARGS__ ; \
 }
 
   INSTPAT_START();
+  // skip pattern matching for an instruction found in the decoded-instruction cache
+  IFDEF(CONFIG_ICACHE, if (s->handler != NULL) goto *s->handler);
+  INSTPAT_DISPATCH(s);
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc  , U, R(rd) = s->pc + imm);
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
 
+  INSTPAT("00010?? 00000 ????? 010 ????? 01011 11", lr.w     , R, R(rd) = lr(src1));
+  INSTPAT("00011?? ????? ????? 010 ????? 01011 11", sc.w     , R, R(rd) = sc(src1, src2));
+  INSTPAT("00001?? ????? ????? 010 ????? 01011 11", amoswap.w, R, R(rd) = amo(src1, src2, AMO_SWAP));
+  INSTPAT("00000?? ????? ????? 010 ????? 01011 11", amoadd.w , R, R(rd) = amo(src1, src2, AMO_ADD));
+  INSTPAT("00100?? ????? ????? 010 ????? 01011 11", amoxor.w , R, R(rd) = amo(src1, src2, AMO_XOR));
+  INSTPAT("01100?? ????? ????? 010 ????? 01011 11", amoand.w , R, R(rd) = amo(src1, src2, AMO_AND));
+  INSTPAT("01000?? ????? ????? 010 ????? 01011 11", amoor.w  , R, R(rd) = amo(src1, src2, AMO_OR));
+  INSTPAT("10000?? ????? ????? 010 ????? 01011 11", amomin.w , R, R(rd) = amo(src1, src2, AMO_MIN));
+  INSTPAT("10100?? ????? ????? 010 ????? 01011 11", amomax.w , R, R(rd) = amo(src1, src2, AMO_MAX));
+  INSTPAT("11000?? ????? ????? 010 ????? 01011 11", amominu.w, R, R(rd) = amo(src1, src2, AMO_MINU));
+  INSTPAT("11100?? ????? ????? 010 ????? 01011 11", amomaxu.w, R, R(rd) = amo(src1, src2, AMO_MAXU));
+
+  INSTPAT("1111000 10100 00000 010 ????? 11100 11", csrr   , N, R(rd) = cpu.mhartid); // csrr rd, mhartid
+  INSTPAT("0001100 00000 ????? 001 ????? 11100 11", csrrw  , I, word_t t = cpu.satp; isa_satp_write(src1); R(rd) = t); // csrrw rd, satp, rs1
+  INSTPAT("0001100 00000 00000 010 ????? 11100 11", csrr   , N, R(rd) = cpu.satp); // csrr rd, satp
+  INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence.vma, R, isa_sfence_vma(src1, s->isa.rs1 == 0, src2, s->isa.rs2 == 0));
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
@@ -70,7 +178,80 @@ static int decode_exec(Decode *s) {
   return 0;
 }
 
+#ifdef CONFIG_FUSION
+/* Superinstructions. An `auipc' followed by a load/store addressing through
+ * its result is executed as a pair, with the address folded into a constant.
+ * The second instruction is recognized by its opcode, which should be kept
+ * in sync with the INSTPAT table above.
+ */
+enum { FUSE_NONE, FUSE_AUIPC_LBU, FUSE_AUIPC_SB };
+
+// turn the icache entry of the instruction just decoded into a superinstruction if possible
+static void fuse(Decode *s) {
+  ICacheEntry *e = icache_entry(s->pc);
+  ISADecodeInfo *d = &e->isa;
+  if (e->tag != (s->pc | 1) || BITS(d->inst.val, 6, 0) != 0x17 || d->rd == 0) return;
+  if (isa_mmu_check(s->snpc, 4, MEM_TYPE_IFETCH) != MMU_DIRECT) return;
+  if (!in_pmem(s->snpc) || !in_pmem(s->snpc + 3)) return;
+
+  uint32_t i = paddr_read(s->snpc, 4);
+  if (BITS(i, 19, 15) != d->rd) return;
+  word_t base = s->pc + d->imm;
+  int op = BITS(i, 6, 0), funct3 = BITS(i, 14, 12);
+  if (op == 0x03 && funct3 == 4) { // lbu
+    d->fuse = FUSE_AUIPC_LBU;
+    d->fused.rd = BITS(i, 11, 7);
+    d->fused.addr = base + SEXT(BITS(i, 31, 20), 12);
+  } else if (op == 0x23 && funct3 == 0) { // sb
+    d->fuse = FUSE_AUIPC_SB;
+    d->fused.rs2 = BITS(i, 24, 20);
+    d->fused.addr = base + ((SEXT(BITS(i, 31, 25), 7) << 5) | BITS(i, 11, 7));
+  } else {
+    return;
+  }
+  e->snpc = s->snpc + 4;
+}
+
+static int fused_exec(Decode *s) {
+  ISADecodeInfo *d = &s->isa;
+  R(d->rd) = s->pc + d->imm;
+  INSTPAT_COUNT(auipc);
+  switch (d->fuse) {
+    case FUSE_AUIPC_LBU: INSTPAT_COUNT(lbu); R(d->fused.rd) = Mr(d->fused.addr, 1); break;
+    case FUSE_AUIPC_SB:  INSTPAT_COUNT(sb);  Mw(d->fused.addr, 1, R(d->fused.rs2)); break;
+  }
+  R(0) = 0;
+  s->dnpc = s->snpc;
+  s->nr_inst = 2;
+  return 0;
+}
+#endif
+
 int isa_exec_once(Decode *s) {
+#ifdef CONFIG_FUSION
+  int max_inst = s->nr_inst;
+  s->nr_inst = 1;
+  if (icache_lookup(s)) {
+    if (s->isa.fuse == FUSE_NONE) return decode_exec(s);
+    if (max_inst >= 2) return fused_exec(s);
+    // run the leading instruction alone
+    s->snpc = s->pc + 4;
+    return decode_exec(s);
+  }
   s->isa.inst.val = inst_fetch(&s->snpc, 4);
+  s->isa.fuse = FUSE_NONE;
+  int ret = decode_exec(s);
+  fuse(s);
+  return ret;
+#else
+  IFDEF(CONFIG_ICACHE, if (icache_lookup(s)) return decode_exec(s));
+  s->isa.inst.val = inst_fetch(&s->snpc, 4);
+  return decode_exec(s);
+#endif
+}
+
+#ifdef CONFIG_ICACHE
+int isa_exec_decoded(Decode *s) {
   return decode_exec(s);
 }
+#endif
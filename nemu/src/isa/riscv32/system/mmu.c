@@ -16,7 +16,158 @@
 #include <isa.h>
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
+#include <cpu/decode.h>
 
+void block_flush();
+
+// the decoded instructions and the software TLB are cached by virtual
+// address only, so they are flushed whenever the translation may change
+static void flush_vaddr_caches() {
+  IFDEF(CONFIG_ICACHE, icache_flush());
+  IFDEF(CONFIG_BLOCK_CACHE, block_flush());
+  IFDEF(CONFIG_SOFT_TLB, soft_tlb_flush());
+}
+
+#ifdef CONFIG_RV_SV32
+enum { PTE_V = 0x01, PTE_R = 0x02, PTE_W = 0x04, PTE_X = 0x08,
+       PTE_U = 0x10, PTE_G = 0x20, PTE_A = 0x40, PTE_D = 0x80 };
+
+#define SATP_MODE(satp) BITS(satp, 31, 31)
+#define SATP_ASID(satp) BITS(satp, 30, 22)
+#define SATP_PPN(satp)  BITS(satp, 21, 0)
+#define PTE_PPN(pte)    BITS(pte, 31, 10)
+
+/* 4-way set-associative TLB indexed by the virtual page number. Entries
+ * are tagged by ASID and the root page table, so switching satp does not
+ * flush them, even for kernels giving every address space ASID 0. A megapage
+ * is cached as the 4 KiB page being accessed, but remembers its size so
+ * that sfence.vma on any address inside it removes it.
+ */
+#define TLB_WAYS 4
+#define TLB_SETS (CONFIG_RV_TLB_SIZE / TLB_WAYS)
+
+#if (CONFIG_RV_TLB_SIZE & (CONFIG_RV_TLB_SIZE - 1)) != 0 || CONFIG_RV_TLB_SIZE < TLB_WAYS
+#error CONFIG_RV_TLB_SIZE should be a power of 2 and no less than 4
+#endif
+
+typedef struct {
+  bool valid;
+  bool mega;
+  uint16_t asid;
+  uint8_t flag; // PTE_*, with PTE_G for global mappings
+  uint32_t root; // PPN of the root page table
+  uint32_t vpn;
+  uint32_t ppn;
+} TLBEntry;
+
+static HART_LOCAL TLBEntry tlb[TLB_SETS][TLB_WAYS] = {};
+static HART_LOCAL uint8_t tlb_victim[TLB_SETS] = {};
+static HART_LOCAL uint64_t nr_hit = 0, nr_walk = 0;
+
+static inline bool perm_ok(int flag, int type) {
+  switch (type) {
+    case MEM_TYPE_IFETCH: return flag & PTE_X;
+    case MEM_TYPE_READ:   return flag & PTE_R;
+    // the page should be already marked dirty
+    default:              return (flag & (PTE_W | PTE_D)) == (PTE_W | PTE_D);
+  }
+}
+
+static TLBEntry* tlb_lookup(uint32_t vpn, int asid, uint32_t root) {
+  TLBEntry *set = tlb[vpn % TLB_SETS];
+  for (int i = 0; i < TLB_WAYS; i ++) {
+    TLBEntry *e = &set[i];
+    if (e->valid && e->vpn == vpn &&
+        ((e->asid == asid && e->root == root) || (e->flag & PTE_G))) return e;
+  }
+  return NULL;
+}
+
+static void tlb_fill(uint32_t vpn, int asid, uint32_t root, uint32_t ppn, int flag, bool mega) {
+  TLBEntry *e = tlb_lookup(vpn, asid, root);
+  if (e == NULL) {
+    int idx = vpn % TLB_SETS;
+    e = &tlb[idx][tlb_victim[idx]];
+    tlb_victim[idx] = (tlb_victim[idx] + 1) % TLB_WAYS;
+  }
+  *e = (TLBEntry) { .valid = true, .mega = mega, .asid = asid, .flag = flag,
+    .root = root, .vpn = vpn, .ppn = ppn };
+}
+
+// walk the page table, return the physical page number or -1 on page fault
+static int64_t walk(vaddr_t vaddr, int type, int asid) {
+  uint32_t vpn = vaddr >> PAGE_SHIFT;
+  paddr_t pte_addr = ((paddr_t)SATP_PPN(cpu.satp) << PAGE_SHIFT) + BITS(vaddr, 31, 22) * 4;
+  word_t pte = paddr_read(pte_addr, 4);
+  int global = pte & PTE_G;
+  bool mega = true;
+  if ((pte & PTE_V) && !(pte & (PTE_R | PTE_X))) {
+    // pointer to the next level
+    pte_addr = ((paddr_t)PTE_PPN(pte) << PAGE_SHIFT) + BITS(vaddr, 21, 12) * 4;
+    pte = paddr_read(pte_addr, 4);
+    global |= pte & PTE_G;
+    mega = false;
+  }
+  if (!(pte & PTE_V) || !(pte & (PTE_R | PTE_X)) || ((pte & PTE_W) && !(pte & PTE_R))) return -1;
+  if (mega && BITS(pte, 19, 10) != 0) return -1; // misaligned megapage
+
+  // update the A/D bits in the page table
+  word_t new_pte = pte | PTE_A | (type == MEM_TYPE_WRITE && (pte & PTE_W) ? PTE_D : 0);
+  if (new_pte != pte) paddr_write(pte_addr, 4, new_pte);
+
+  uint32_t ppn = PTE_PPN(pte) | (mega ? BITS(vpn, 9, 0) : 0);
+  int flag = (new_pte & 0xff & ~PTE_G) | global;
+  tlb_fill(vpn, asid, SATP_PPN(cpu.satp), ppn, flag, mega);
+  if (!perm_ok(flag, type)) return -1;
+  return ppn;
+}
+
+paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
+  if ((vaddr & PAGE_MASK) + len > PAGE_SIZE) return MEM_RET_CROSS_PAGE;
+  int asid = SATP_ASID(cpu.satp);
+  TLBEntry *e = tlb_lookup(vaddr >> PAGE_SHIFT, asid, SATP_PPN(cpu.satp));
+  if (e != NULL && perm_ok(e->flag, type)) {
+    nr_hit ++;
+    return (paddr_t)e->ppn << PAGE_SHIFT | MEM_RET_OK;
+  }
+  nr_walk ++;
+  int64_t ppn = walk(vaddr, type, asid);
+  if (ppn < 0) return MEM_RET_FAIL;
+  return (paddr_t)ppn << PAGE_SHIFT | MEM_RET_OK;
+}
+
+// rs1 == x0 flushes all addresses, rs2 == x0 flushes all address spaces
+void isa_sfence_vma(vaddr_t vaddr, bool all_vaddr, int asid, bool all_asid) {
+  uint32_t vpn = vaddr >> PAGE_SHIFT;
+  for (int i = 0; i < TLB_SETS; i ++) {
+    for (int j = 0; j < TLB_WAYS; j ++) {
+      TLBEntry *e = &tlb[i][j];
+      bool addr_hit = all_vaddr || (e->mega ? (e->vpn >> 10) == (vpn >> 10) : e->vpn == vpn);
+      bool asid_hit = all_asid || (e->asid == asid && !(e->flag & PTE_G));
+      if (addr_hit && asid_hit) e->valid = false;
+    }
+  }
+  flush_vaddr_caches();
+}
+
+void isa_mmu_statistic() {
+  uint64_t total = nr_hit + nr_walk;
+  if (total == 0) return;
+  Log("TLB hit = %" PRIu64 ", walk = %" PRIu64 ", hit rate = %.2f%%",
+      nr_hit, nr_walk, 100.0 * nr_hit / total);
+}
+#else
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
+
+void isa_sfence_vma(vaddr_t vaddr, bool all_vaddr, int asid, bool all_asid) {
+  flush_vaddr_caches();
+}
+#endif
+
+void isa_satp_write(word_t satp) {
+  cpu.satp = satp;
+  // the TLB above is tagged, but the other caches are not
+  flush_vaddr_caches();
+}
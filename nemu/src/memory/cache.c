@@ -0,0 +1,191 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_CACHE_SIM
+/* A set-associative, write-back and write-allocate cache. A miss fetches
+ * the line from the next level, and the eviction of a dirty line writes
+ * it back to the next level. The last level is backed by the memory.
+ */
+typedef struct Cache {
+  const char *name;
+  int line_shift, ways;
+  uint32_t nr_set;
+  uint64_t *tag;    // line number + 1 of each way, 0 if invalid
+  bool *dirty;
+  uint64_t *stamp;  // LRU: time of the last access of each way
+  uint64_t *plru;   // PLRU: tree bits of each set, node i (from 1) at bit i
+  int latency;
+  struct Cache *next;
+  uint64_t hit[3], miss[3]; // indexed by MEM_TYPE_*
+  uint64_t writeback;
+} Cache;
+
+static Cache l1i, l1d, l2;
+IFNDEF(CONFIG_CACHE_PLRU, static uint64_t now = 0);
+static uint64_t nr_mem_read = 0, nr_mem_write = 0;
+static uint64_t cycles = 0;
+
+static int log2_exact(int x, const char *what) {
+  int n = 0;
+  while ((1 << n) < x) n ++;
+  Assert(x > 0 && (1 << n) == x, "%s should be a power of 2", what);
+  return n;
+}
+
+static void cache_init(Cache *c, const char *name, int size, int line, int ways, int latency, Cache *next) {
+  c->name = name;
+  c->line_shift = log2_exact(line, "cache line size");
+  log2_exact(ways, "cache associativity");
+  Assert(ways <= 64, "%s: at most 64 ways", name);
+  c->ways = ways;
+  c->nr_set = size / line / ways;
+  log2_exact(c->nr_set, "number of cache sets");
+  c->tag = calloc((size_t)c->nr_set * ways, sizeof(uint64_t));
+  c->dirty = calloc((size_t)c->nr_set * ways, sizeof(bool));
+  c->stamp = calloc((size_t)c->nr_set * ways, sizeof(uint64_t));
+  c->plru = calloc(c->nr_set, sizeof(uint64_t));
+  assert(c->tag && c->dirty && c->stamp && c->plru);
+  c->latency = latency;
+  c->next = next;
+  Log("%s: %d bytes, %d-byte lines, %d ways, %u sets", name, size, line, ways, c->nr_set);
+}
+
+static void touch(Cache *c, uint32_t set, int way) {
+#ifdef CONFIG_CACHE_PLRU
+  // make the nodes on the path point away from `way'
+  uint64_t *bits = &c->plru[set];
+  int node = 1, level;
+  for (level = c->ways >> 1; level > 0; level >>= 1) {
+    int b = (way & level) != 0;
+    if (b) *bits &= ~(1ull << node);
+    else *bits |= 1ull << node;
+    node = node * 2 + b;
+  }
+#else
+  c->stamp[set * c->ways + way] = ++ now;
+#endif
+}
+
+static int victim(Cache *c, uint32_t set) {
+  uint64_t *tag = &c->tag[set * c->ways];
+  int w;
+  for (w = 0; w < c->ways; w ++) {
+    if (tag[w] == 0) return w;
+  }
+#ifdef CONFIG_CACHE_PLRU
+  int node = 1;
+  w = 0;
+  while (node < c->ways) {
+    int b = (c->plru[set] >> node) & 1;
+    w = w * 2 + b;
+    node = node * 2 + b;
+  }
+  return w;
+#else
+  uint64_t *stamp = &c->stamp[set * c->ways];
+  int v = 0;
+  for (w = 1; w < c->ways; w ++) {
+    if (stamp[w] < stamp[v]) v = w;
+  }
+  return v;
+#endif
+}
+
+static void next_level(Cache *c, paddr_t addr, int type);
+
+// access the line containing `addr' and return the cycles spent
+static uint64_t cache_line_access(Cache *c, paddr_t addr, int type) {
+  uint64_t line = addr >> c->line_shift;
+  uint32_t set = line & (c->nr_set - 1);
+  uint64_t *tag = &c->tag[set * c->ways];
+  int w;
+  for (w = 0; w < c->ways; w ++) {
+    if (tag[w] == line + 1) {
+      c->hit[type] ++;
+      c->dirty[set * c->ways + w] |= (type == MEM_TYPE_WRITE);
+      touch(c, set, w);
+      return c->latency;
+    }
+  }
+
+  c->miss[type] ++;
+  w = victim(c, set);
+  if (tag[w] != 0 && c->dirty[set * c->ways + w]) {
+    c->writeback ++;
+    // write-back buffers hide its latency
+    next_level(c, (tag[w] - 1) << c->line_shift, MEM_TYPE_WRITE);
+  }
+  uint64_t lat = c->latency;
+  if (c->next != NULL) lat += cache_line_access(c->next, addr, (type == MEM_TYPE_WRITE ? MEM_TYPE_READ : type));
+  else { nr_mem_read ++; lat += CONFIG_CACHE_MEM_LATENCY; }
+  tag[w] = line + 1;
+  c->dirty[set * c->ways + w] = (type == MEM_TYPE_WRITE);
+  touch(c, set, w);
+  return lat;
+}
+
+static void next_level(Cache *c, paddr_t addr, int type) {
+  if (c->next != NULL) cache_line_access(c->next, addr, type);
+  else nr_mem_write ++;
+}
+
+void cache_access(paddr_t addr, int len, int type) {
+  if (!in_pmem(addr)) return; // devices are not cached
+  Cache *c = (type == MEM_TYPE_IFETCH ? &l1i : &l1d);
+  cycles += cache_line_access(c, addr, type);
+  // an access crossing two lines
+  paddr_t last = addr + len - 1;
+  if ((last >> c->line_shift) != (addr >> c->line_shift)) cycles += cache_line_access(c, last, type);
+}
+
+void init_cache() {
+  Cache *last = NULL;
+  if (CONFIG_CACHE_L2_SIZE > 0) {
+    cache_init(&l2, "L2", CONFIG_CACHE_L2_SIZE, CONFIG_CACHE_L2_LINE, CONFIG_CACHE_L2_WAYS,
+        CONFIG_CACHE_L2_LATENCY, NULL);
+    Assert(CONFIG_CACHE_L2_LINE >= CONFIG_CACHE_L1I_LINE && CONFIG_CACHE_L2_LINE >= CONFIG_CACHE_L1D_LINE,
+        "L2 lines should not be smaller than L1 lines");
+    last = &l2;
+  }
+  cache_init(&l1i, "L1I", CONFIG_CACHE_L1I_SIZE, CONFIG_CACHE_L1I_LINE, CONFIG_CACHE_L1I_WAYS,
+      CONFIG_CACHE_L1_LATENCY, last);
+  cache_init(&l1d, "L1D", CONFIG_CACHE_L1D_SIZE, CONFIG_CACHE_L1D_LINE, CONFIG_CACHE_L1D_WAYS,
+      CONFIG_CACHE_L1_LATENCY, last);
+}
+
+static void cache_report(Cache *c) {
+  static const char *type_name[] = { "fetch", "read", "write" };
+  int t;
+  for (t = 0; t < 3; t ++) {
+    uint64_t total = c->hit[t] + c->miss[t];
+    if (total == 0) continue;
+    Log("%s %s: hit = %" PRIu64 ", miss = %" PRIu64 ", miss rate = %.2f%%",
+        c->name, type_name[t], c->hit[t], c->miss[t], 100.0 * c->miss[t] / total);
+  }
+  if (c->writeback != 0) Log("%s writeback = %" PRIu64, c->name, c->writeback);
+}
+
+void cache_statistic(uint64_t nr_inst) {
+  cache_report(&l1i);
+  cache_report(&l1d);
+  if (CONFIG_CACHE_L2_SIZE > 0) cache_report(&l2);
+  Log("memory read = %" PRIu64 " lines, write = %" PRIu64 " lines", nr_mem_read, nr_mem_write);
+  if (nr_inst == 0) return;
+  Log("estimated memory access cycles = %" PRIu64 ", %.3f per instruction", cycles, (double)cycles / nr_inst);
+}
+#endif
@@ -13,14 +13,19 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
+#define _GNU_SOURCE // for mremap()
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
+#include <cpu/decode.h>
 #include <isa.h>
 
-#if   defined(CONFIG_PMEM_MALLOC)
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
 static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
+// larger arrays can not be addressed with the default code model
+static_assert(CONFIG_MSIZE <= 0x40000000ul, "pmem larger than 1 GiB should use PMEM_MMAP");
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 #endif
 
@@ -32,29 +37,148 @@ static word_t pmem_read(paddr_t addr, int len) {
   return ret;
 }
 
+void block_invalidate(paddr_t addr, int len);
+
 static void pmem_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_ICACHE, icache_invalidate(addr, len));
+  IFDEF(CONFIG_BLOCK_CACHE, block_invalidate(addr, len));
   host_write(guest_to_host(addr), len, data);
 }
 
+void block_invalidate_range(paddr_t addr, size_t len);
+
+void pmem_invalidate(paddr_t addr, size_t len) {
+  if (len == 0) return;
+#if defined(CONFIG_BLOCK_CACHE)
+  // every decoded instruction is in a line marked in code_map
+  block_invalidate_range(addr, len);
+#elif defined(CONFIG_ICACHE)
+  if (len / 4 >= CONFIG_ICACHE_SIZE) icache_flush();
+  else icache_invalidate(addr, len);
+#endif
+}
+
 static void out_of_bound(paddr_t addr) {
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
 }
 
+#ifdef CONFIG_PMEM_MMAP
+#include <sys/mman.h>
+
+#ifdef CONFIG_MEM_RANDOM
+#include <signal.h>
+
+/* pmem is mapped inaccessible, and a chunk is filled with the random value
+ * on its first access, so that only the memory in use is backed by the
+ * host. The filled chunk is prepared aside and moved into place by
+ * mremap(), so that another thread never sees a partially filled chunk.
+ */
+#define FILL_CHUNK (256 * 1024)
+static_assert(CONFIG_MSIZE % FILL_CHUNK == 0, "CONFIG_MSIZE should be a multiple of 256 KiB");
+
+enum { CHUNK_EMPTY, CHUNK_FILLING, CHUNK_READY };
+static uint8_t chunk_state[CONFIG_MSIZE / FILL_CHUNK] = {};
+static uint8_t fill_byte = 0;
+static struct sigaction old_segv;
+
+static void fill_chunk(size_t idx) {
+  uint8_t state = CHUNK_EMPTY;
+  if (!__atomic_compare_exchange_n(&chunk_state[idx], &state, CHUNK_FILLING,
+        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    // filled by another thread
+    while (__atomic_load_n(&chunk_state[idx], __ATOMIC_ACQUIRE) != CHUNK_READY);
+    return;
+  }
+  void *tmp = mmap(NULL, FILL_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(tmp != MAP_FAILED);
+  memset(tmp, fill_byte, FILL_CHUNK);
+  void *ret = mremap(tmp, FILL_CHUNK, FILL_CHUNK, MREMAP_MAYMOVE | MREMAP_FIXED, pmem + idx * FILL_CHUNK);
+  assert(ret != MAP_FAILED);
+  __atomic_store_n(&chunk_state[idx], CHUNK_READY, __ATOMIC_RELEASE);
+}
+
+void pmem_populate(paddr_t paddr, size_t len) {
+  if (len == 0) return;
+  Assert(in_pmem(paddr) && in_pmem(paddr + len - 1), "populating out of pmem");
+  size_t first = (paddr - CONFIG_MBASE) / FILL_CHUNK, last = (paddr + len - 1 - CONFIG_MBASE) / FILL_CHUNK;
+  for (size_t i = first; i <= last; i ++) {
+    if (__atomic_load_n(&chunk_state[i], __ATOMIC_ACQUIRE) != CHUNK_READY) fill_chunk(i);
+  }
+}
+
+static void segv_handler(int sig, siginfo_t *info, void *ucontext) {
+  uint8_t *addr = info->si_addr;
+  if (addr >= pmem && addr < pmem + CONFIG_MSIZE) {
+    fill_chunk((addr - pmem) / FILL_CHUNK);
+    return;
+  }
+  // not caused by pmem, fault again with the original handler
+  sigaction(SIGSEGV, &old_segv, NULL);
+}
+#endif
+
+static void init_pmem_mmap() {
+  int prot = MUXDEF(CONFIG_MEM_RANDOM, PROT_NONE, PROT_READ | PROT_WRITE);
+  pmem = mmap(NULL, CONFIG_MSIZE, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(pmem != MAP_FAILED, "Can not map pmem");
+#ifdef CONFIG_MEM_RANDOM
+  fill_byte = rand();
+  struct sigaction s = {};
+  s.sa_sigaction = segv_handler;
+  s.sa_flags = SA_SIGINFO;
+  int ret = sigaction(SIGSEGV, &s, &old_segv);
+  Assert(ret == 0, "Can not set signal handler");
+#endif
+}
+#endif
+
+#if !defined(CONFIG_PMEM_MMAP) || !defined(CONFIG_MEM_RANDOM)
+void pmem_populate(paddr_t paddr, size_t len) {
+}
+#endif
+
+bool pmem_map_file(paddr_t paddr, int fd, size_t size) {
+#ifdef CONFIG_PMEM_MMAP
+  size_t len = ROUNDUP(size, PAGE_SIZE);
+  if ((paddr & PAGE_MASK) != 0 || size == 0 || !in_pmem(paddr) || !in_pmem(paddr + len - 1)) return false;
+#ifdef CONFIG_MEM_RANDOM
+  // the chunks covered by the file need no filling, only those partially covered do
+  size_t first = (paddr - CONFIG_MBASE) / FILL_CHUNK, last = (paddr + len - 1 - CONFIG_MBASE) / FILL_CHUNK;
+  for (size_t i = first; i <= last; i ++) {
+    bool covered = guest_to_host(paddr) <= pmem + i * FILL_CHUNK &&
+      pmem + (i + 1) * FILL_CHUNK <= guest_to_host(paddr) + len;
+    if (covered) __atomic_store_n(&chunk_state[i], CHUNK_READY, __ATOMIC_RELEASE);
+    else pmem_populate(CONFIG_MBASE + i * FILL_CHUNK, FILL_CHUNK);
+  }
+#endif
+  void *p = mmap(guest_to_host(paddr), len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+  Assert(p != MAP_FAILED, "Can not map the file to pmem");
+  return true;
+#else
+  return false;
+#endif
+}
+
 void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  init_pmem_mmap();
 #endif
-  IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+  // with mmap the memory is filled on demand
+  IFNDEF(CONFIG_PMEM_MMAP, IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE)));
+  IFDEF(CONFIG_SOFT_TLB, soft_tlb_flush());
+  IFDEF(CONFIG_CACHE_SIM, init_cache());
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
 word_t paddr_read(paddr_t addr, int len) {
-  if (likely(in_pmem(addr))) return pmem_read(addr, len);
-  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
-  out_of_bound(addr);
-  return 0;
+  word_t ret = 0;
+  if (likely(in_pmem(addr))) ret = pmem_read(addr, len);
+  else MUXDEF(CONFIG_DEVICE, ret = mmio_read(addr, len), out_of_bound(addr));
+  return ret;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
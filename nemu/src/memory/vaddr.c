@@ -15,15 +15,95 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+paddr_t vaddr_translate(vaddr_t addr, int len, int type) {
+  if (isa_mmu_check(addr, len, type) == MMU_DIRECT) return addr;
+  paddr_t pg = isa_mmu_translate(addr, len, type);
+  Assert((pg & PAGE_MASK) == MEM_RET_OK, "fail to translate vaddr = " FMT_WORD " at pc = " FMT_WORD,
+      addr, cpu.pc);
+  return (pg & ~(paddr_t)PAGE_MASK) | (addr & PAGE_MASK);
+}
+
+#ifdef CONFIG_SOFT_TLB
+#include <cpu/decode.h>
+
+HART_LOCAL SoftTLBEntry soft_tlb[3][CONFIG_SOFT_TLB_SIZE] = {};
+
+void soft_tlb_flush() {
+  for (int t = 0; t < 3; t ++) {
+    for (int i = 0; i < CONFIG_SOFT_TLB_SIZE; i ++) {
+      // a masked address never has all the low bits set
+      soft_tlb[t][i].tag = (vaddr_t)-1;
+    }
+  }
+}
+
+#ifdef CONFIG_DEVICE
+uint8_t* mmio_ram_page(paddr_t pg);
+void io_space_set_dirty(uint8_t *p, int len);
+#endif
+
+// translate `addr' and refill the TLB of `type' with its page if it is in pmem
+// or in a RAM-like device map
+static paddr_t refill(vaddr_t addr, int len, int type) {
+  paddr_t paddr = vaddr_translate(addr, len, type);
+  paddr_t pg = paddr & ~(paddr_t)PAGE_MASK;
+  uint8_t *host = NULL;
+  if (in_pmem(pg)) host = guest_to_host(pg);
+  // DiffTest should see every device access to skip it in REF
+  else IFDEF(CONFIG_DEVICE, IFNDEF(CONFIG_DIFFTEST, host = mmio_ram_page(pg)));
+  if (host != NULL) {
+    SoftTLBEntry *e = &soft_tlb[type][(addr >> PAGE_SHIFT) & (CONFIG_SOFT_TLB_SIZE - 1)];
+    e->tag = addr & ~(vaddr_t)PAGE_MASK;
+    e->addend = (uintptr_t)host - e->tag;
+  }
+  return paddr;
+}
+
+word_t vaddr_read_slow(vaddr_t addr, int len, int type) {
+  return paddr_read(refill(addr, len, type), len);
+}
+
+void block_invalidate(paddr_t addr, int len);
+
+void vaddr_write(vaddr_t addr, int len, word_t data) {
+  uint8_t *p = soft_tlb_lookup(addr, len, MEM_TYPE_WRITE);
+  if (likely(p != NULL)) {
+#if defined(CONFIG_ICACHE) || defined(CONFIG_BLOCK_CACHE) || defined(CONFIG_DEVICE)
+    if (likely(host_in_pmem(p))) {
+      // keep the decoded instructions coherent, as pmem_write() does
+      IFDEF(CONFIG_ICACHE, icache_invalidate(host_to_guest(p), len));
+      IFDEF(CONFIG_BLOCK_CACHE, block_invalidate(host_to_guest(p), len));
+    }
+    IFDEF(CONFIG_DEVICE, else io_space_set_dirty(p, len));
+#endif
+    host_write(p, len, data);
+    return;
+  }
+  paddr_write(refill(addr, len, MEM_TYPE_WRITE), len, data);
+}
+#else
+static inline word_t vaddr_read_type(vaddr_t addr, int len, int type) {
+  paddr_t paddr = vaddr_translate(addr, len, type);
+  IFDEF(CONFIG_CACHE_SIM, cache_access(paddr, len, type));
+  word_t ret = paddr_read(paddr, len);
+  IFDEF(CONFIG_MTRACE, mtrace_access(paddr, len, ret, type));
+  return ret;
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return vaddr_read_type(addr, len, MEM_TYPE_IFETCH);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  return vaddr_read_type(addr, len, MEM_TYPE_READ);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  paddr_t paddr = vaddr_translate(addr, len, MEM_TYPE_WRITE);
+  IFDEF(CONFIG_CACHE_SIM, cache_access(paddr, len, MEM_TYPE_WRITE));
+  IFDEF(CONFIG_MTRACE, mtrace_access(paddr, len, data, MEM_TYPE_WRITE));
+  paddr_write(paddr, len, data);
 }
+#endif
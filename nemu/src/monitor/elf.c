@@ -0,0 +1,135 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+
+#ifndef CONFIG_TARGET_AM
+#include <elf.h>
+#include <unistd.h>
+
+#define ELF(type) concat(MUXDEF(CONFIG_ISA64, Elf64_, Elf32_), type)
+#define ELF_CLASS MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32)
+#define ELF_ST_TYPE(info) MUXDEF(CONFIG_ISA64, ELF64_ST_TYPE(info), ELF32_ST_TYPE(info))
+
+typedef struct {
+  vaddr_t addr;
+  word_t size;
+  const char *name;
+} Symbol;
+
+// function and object symbols, sorted by address
+static Symbol *syms = NULL;
+static int nr_sym = 0;
+static char *strtab = NULL;
+
+static void read_at(int fd, void *buf, size_t len, off_t off) {
+  ssize_t ret = pread(fd, buf, len, off);
+  Assert(ret == len, "Can not read %zu bytes at offset %ld of the ELF file", len, (long)off);
+}
+
+static int cmp_sym(const void *a, const void *b) {
+  vaddr_t x = ((const Symbol *)a)->addr, y = ((const Symbol *)b)->addr;
+  return (x > y) - (x < y);
+}
+
+static void load_symtab(int fd, ELF(Ehdr) *eh) {
+  if (eh->e_shoff == 0 || eh->e_shentsize != sizeof(ELF(Shdr))) return;
+  ELF(Shdr) *sh = malloc(sizeof(*sh) * eh->e_shnum);
+  assert(sh);
+  read_at(fd, sh, sizeof(*sh) * eh->e_shnum, eh->e_shoff);
+
+  int i;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) continue;
+    ELF(Shdr) *str = &sh[sh[i].sh_link];
+    strtab = malloc(str->sh_size + 1);
+    assert(strtab);
+    read_at(fd, strtab, str->sh_size, str->sh_offset);
+    strtab[str->sh_size] = '\0';
+
+    int n = sh[i].sh_size / sizeof(ELF(Sym));
+    ELF(Sym) *s = malloc(sizeof(*s) * n);
+    syms = malloc(sizeof(Symbol) * n);
+    assert(s && syms);
+    read_at(fd, s, sizeof(*s) * n, sh[i].sh_offset);
+    int j;
+    for (j = 0; j < n; j ++) {
+      int type = ELF_ST_TYPE(s[j].st_info);
+      if ((type != STT_FUNC && type != STT_OBJECT) || s[j].st_shndx == SHN_UNDEF ||
+          s[j].st_name >= str->sh_size) continue;
+      syms[nr_sym ++] = (Symbol) { .addr = s[j].st_value, .size = s[j].st_size,
+        .name = strtab + s[j].st_name };
+    }
+    free(s);
+    qsort(syms, nr_sym, sizeof(Symbol), cmp_sym);
+    Log("%d symbols are loaded", nr_sym);
+    break;
+  }
+  free(sh);
+}
+
+// return the symbol containing `addr' and the offset of `addr' in it, or NULL
+const char* elf_symbol(vaddr_t addr, word_t *offset) {
+  // find the last symbol starting at or before `addr'
+  int l = 0, r = nr_sym;
+  while (l < r) {
+    int m = l + (r - l) / 2;
+    if (syms[m].addr <= addr) l = m + 1;
+    else r = m;
+  }
+  if (l == 0) return NULL;
+  Symbol *s = &syms[l - 1];
+  word_t off = addr - s->addr;
+  if (off >= (s->size == 0 ? 1 : s->size)) return NULL;
+  if (offset) *offset = off;
+  return s->name;
+}
+
+// load the PT_LOAD segments of an ELF image and set the pc to its entry,
+// return the size of the memory from RESET_VECTOR to the end of the image,
+// or -1 if `fp' is not an ELF file
+long load_elf(FILE *fp) {
+  int fd = fileno(fp);
+  ELF(Ehdr) eh;
+  if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) || memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0) return -1;
+  Assert(eh.e_ident[EI_CLASS] == ELF_CLASS && eh.e_phentsize == sizeof(ELF(Phdr)),
+      "The ELF file does not match %s", str(__GUEST_ISA__));
+
+  ELF(Phdr) *ph = malloc(sizeof(*ph) * eh.e_phnum);
+  assert(ph);
+  read_at(fd, ph, sizeof(*ph) * eh.e_phnum, eh.e_phoff);
+  paddr_t end = RESET_VECTOR;
+  int i;
+  for (i = 0; i < eh.e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    paddr_t addr = ph[i].p_paddr;
+    size_t filesz = ph[i].p_filesz, memsz = ph[i].p_memsz;
+    Assert(in_pmem(addr) && in_pmem(addr + memsz - 1) && filesz <= memsz,
+        "Segment [" FMT_PADDR ", " FMT_PADDR ") is out of pmem", addr, (paddr_t)(addr + memsz));
+    pmem_populate(addr, memsz);
+    read_at(fd, guest_to_host(addr), filesz, ph[i].p_offset);
+    // .bss is not in the file
+    memset(guest_to_host(addr) + filesz, 0, memsz - filesz);
+    Log("Segment [" FMT_PADDR ", " FMT_PADDR ") is loaded", addr, (paddr_t)(addr + memsz));
+    if (addr + memsz > end) end = addr + memsz;
+  }
+  free(ph);
+
+  cpu.pc = eh.e_entry;
+  load_symtab(fd, &eh);
+  return end - RESET_VECTOR;
+}
+#endif
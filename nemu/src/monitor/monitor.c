@@ -38,6 +38,9 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void set_device_quantum(uint64_t q);
+long load_elf(FILE *fp);
+void init_smp();
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
@@ -58,7 +61,22 @@ static long load_img() {
 
   Log("The image is %s, size = %ld", img_file, size);
 
+  long elf_size = load_elf(fp);
+  if (elf_size >= 0) {
+    Log("The image is an ELF file, entry = " FMT_WORD, cpu.pc);
+    fclose(fp);
+    return elf_size;
+  }
+
   fseek(fp, 0, SEEK_SET);
+#ifdef CONFIG_PMEM_MAP_IMAGE
+  if (pmem_map_file(RESET_VECTOR, fileno(fp), size)) {
+    Log("The image is mapped copy-on-write");
+    fclose(fp);
+    return size;
+  }
+#endif
+  pmem_populate(RESET_VECTOR, size);
   int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
   assert(ret == 1);
 
@@ -72,16 +90,18 @@ static int parse_args(int argc, char *argv[]) {
     {"log"      , required_argument, NULL, 'l'},
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
+    {"quantum"  , required_argument, NULL, 'q'},
     {"help"     , no_argument      , NULL, 'h'},
     {0          , 0                , NULL,  0 },
   };
   int o;
-  while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:p:q:", table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'q': IFDEF(CONFIG_DEVICE, set_device_quantum(strtoull(optarg, NULL, 0))); break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -89,6 +109,7 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t-q,--quantum=N          update devices every N instructions\n");
         printf("\n");
         exit(0);
     }
@@ -108,6 +129,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Start the memory tracer. */
+  IFDEF(CONFIG_MTRACE, init_mtrace());
+
   /* Initialize memory. */
   init_mem();
 
@@ -120,6 +144,9 @@ void init_monitor(int argc, char *argv[]) {
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+  /* Let the other harts boot from where hart 0 does. */
+  IFDEF(CONFIG_SMP, init_smp());
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
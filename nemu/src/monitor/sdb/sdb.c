@@ -27,6 +27,7 @@ void init_wp_pool();
 void wp_display();
 void wp_set(char*, word_t);
 void wp_delete(int);
+const char* elf_symbol(vaddr_t addr, word_t *offset);
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
 static char* rl_gets() {
@@ -80,7 +81,7 @@ static struct {
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
   { "si", "si [N], Execute N(default one) step", cmd_si },
-  { "info", "info SUBCMD, Print current state of (r)register or (w)watchpoint", cmd_info },
+  { "info", "info SUBCMD, Print current state of (r)register or (w)watchpoint, or (s)symbol of EXPR(default pc)", cmd_info },
   { "x", "x N EXPR, Print data from memory address EXPR to EXPR+4N per 4 Bytes", cmd_x },
   { "p", "p EXPR, Caculate the value of expression EXPR", cmd_p },
   { "w", "w EXPR, Stop executing when EXPR changed", cmd_w },
@@ -134,6 +135,21 @@ static int cmd_si(char *args) {
     return 0;
 }
 
+static void symbol_display(char *e) {
+    bool success = true;
+    vaddr_t addr = (e == NULL ? cpu.pc : expr(e, &success));
+    if (!success) {
+	printf("Invalid expression\n");
+	return;
+    }
+    word_t off = 0;
+    const char *name = elf_symbol(addr, &off);
+    if (name == NULL)
+	printf(FMT_WORD " is not in any symbol\n", addr);
+    else
+	printf(FMT_WORD " <%s+0x%x>\n", addr, name, (unsigned)off);
+}
+
 static int cmd_info(char *args) {
     /* extract the first argument */
     char *arg = strtok(NULL, " ");
@@ -141,6 +157,8 @@ static int cmd_info(char *args) {
 	isa_reg_display();
     else if (*arg == 'w')
 	wp_display();
+    else if (*arg == 's')
+	symbol_display(strtok(NULL, ""));
     else
 	printf("Unknown options and please input \"help info\"\n");
     return 0;
@@ -166,7 +184,7 @@ static int cmd_x(char *args) {
 	assert(0);
     }
     for (int i = 0; i < num; ++i) {
-        printf("0X%x---%d\n", addr, paddr_read(addr, 4));
+        printf(FMT_PADDR "---%d\n", addr, paddr_read(addr, 4));
         addr += 4;
     }
     return 0;
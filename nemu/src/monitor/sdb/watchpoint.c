@@ -109,6 +109,10 @@ void wp_delete(int n) {
     printf("Delete %drd watchpoint\n", n);    
 }
 
+bool wp_active() {
+    return head != NULL;
+}
+
 void wp_difftest() {
     WP *p = head;
     bool stop = false;
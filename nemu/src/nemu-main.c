@@ -31,5 +31,8 @@ int main(int argc, char *argv[]) {
   /* Start engine. */
   engine_start();
 
+  IFDEF(CONFIG_PROFILE, profile_dump());
+  IFDEF(CONFIG_MTRACE, mtrace_close());
+
   return is_exit_status_bad();
 }
@@ -0,0 +1,111 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+
+#ifdef CONFIG_MTRACE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#if (CONFIG_MTRACE_BUF_SIZE & (CONFIG_MTRACE_BUF_SIZE - 1)) != 0
+#error CONFIG_MTRACE_BUF_SIZE should be a power of 2
+#endif
+
+/* The CPU thread appends records to a single-producer single-consumer
+ * ring buffer, and a writer thread drains it to MTRACE_FILE. The file
+ * starts with MTraceHeader, followed by MTraceRecord in the order of
+ * accesses. tools/mtrace-analyse reads this format.
+ */
+#define BUF_SIZE CONFIG_MTRACE_BUF_SIZE
+#define DRAIN_CHUNK (BUF_SIZE / 4)
+
+typedef struct {
+  char magic[8]; // "NEMUMTR"
+  uint32_t version;
+  uint32_t record_size;
+} MTraceHeader;
+
+typedef struct {
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t value;
+  uint8_t len;
+  uint8_t type; // MEM_TYPE_*
+  uint8_t pad[6];
+} MTraceRecord;
+
+static MTraceRecord *buf = NULL;
+static uint64_t head = 0; // written by the CPU thread only
+static uint64_t tail = 0; // written by the writer thread only
+static bool stop = false;
+static FILE *fp = NULL;
+static pthread_t writer;
+
+static void* writer_main(void *arg) {
+  uint64_t t = tail;
+  while (true) {
+    uint64_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (h - t < DRAIN_CHUNK && !__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+      struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+      nanosleep(&ts, NULL);
+      continue;
+    }
+    if (h == t) break; // stopped and drained
+    // the records up to the end of the buffer, the rest is written in the next round
+    uint64_t idx = t & (BUF_SIZE - 1);
+    uint64_t n = (h - t < BUF_SIZE - idx ? h - t : BUF_SIZE - idx);
+    size_t ret = fwrite(&buf[idx], sizeof(MTraceRecord), n, fp);
+    Assert(ret == n, "Can not write the memory trace");
+    t += n;
+    __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+void mtrace_access(paddr_t addr, int len, word_t data, int type) {
+  if (buf == NULL || !log_enable()) return;
+  uint64_t h = head;
+  // wait for the writer if the buffer is full, no record is dropped
+  while (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == BUF_SIZE) sched_yield();
+  buf[h & (BUF_SIZE - 1)] = (MTraceRecord) { .pc = cpu.pc, .addr = addr, .value = data,
+    .len = len, .type = type };
+  __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+}
+
+void init_mtrace() {
+  const char *file = CONFIG_MTRACE_FILE;
+  fp = fopen(file, "wb");
+  Assert(fp, "Can not open '%s'", file);
+  MTraceHeader hdr = { .magic = "NEMUMTR", .version = 2, .record_size = sizeof(MTraceRecord) };
+  fwrite(&hdr, sizeof(hdr), 1, fp);
+  buf = malloc(sizeof(MTraceRecord) * BUF_SIZE);
+  assert(buf);
+  int ret = pthread_create(&writer, NULL, writer_main, NULL);
+  Assert(ret == 0, "Can not create the mtrace writer");
+  Log("Memory trace is written to %s", file);
+}
+
+void mtrace_close() {
+  if (fp == NULL) return;
+  __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+  pthread_join(writer, NULL);
+  fclose(fp);
+  fp = NULL;
+  free(buf);
+  buf = NULL;
+  Log("%" PRIu64 " memory accesses are traced", head);
+}
+#endif
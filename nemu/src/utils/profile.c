@@ -0,0 +1,180 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+
+#ifdef CONFIG_PROFILE
+#if (CONFIG_PROFILE_PC_TABLE_SIZE & (CONFIG_PROFILE_PC_TABLE_SIZE - 1)) != 0
+#error CONFIG_PROFILE_PC_TABLE_SIZE should be a power of 2
+#endif
+
+extern HART_LOCAL uint64_t g_nr_guest_inst;
+const char* elf_symbol(vaddr_t addr, word_t *offset);
+
+// --- instruction mix, one counter per INSTPAT name ---
+#define NR_INST_NAME 256
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+} InstStat;
+
+static InstStat inst_stat[NR_INST_NAME] = {};
+static int nr_inst_name = 0;
+
+uint64_t* profile_inst_counter(const char *name) {
+  int i;
+  for (i = 0; i < nr_inst_name; i ++) {
+    if (strcmp(inst_stat[i].name, name) == 0) return &inst_stat[i].count;
+  }
+  Assert(nr_inst_name < NR_INST_NAME, "too many instruction names");
+  inst_stat[nr_inst_name].name = name;
+  return &inst_stat[nr_inst_name ++].count;
+}
+
+// --- hot pcs, in an open-addressing table with linear probing ---
+#define PC_TABLE_SIZE CONFIG_PROFILE_PC_TABLE_SIZE
+#define PC_TABLE_MAX_LOAD (PC_TABLE_SIZE / 4 * 3)
+
+typedef struct {
+  vaddr_t pc;
+  uint64_t count; // 0 if the entry is empty
+  uint64_t taken; // number of times the control flow leaves `pc' non-sequentially
+} PCStat;
+
+static PCStat pc_table[PC_TABLE_SIZE] = {};
+static uint32_t nr_pc = 0;
+static uint64_t nr_dropped = 0; // instructions not recorded because the table is full
+
+static inline uint32_t pc_hash(vaddr_t pc) {
+  return ((uint32_t)pc * 2654435761u) & (PC_TABLE_SIZE - 1);
+}
+
+void profile_exec(vaddr_t pc, bool taken) {
+  uint32_t i = pc_hash(pc);
+  while (true) {
+    PCStat *e = &pc_table[i];
+    if (likely(e->pc == pc && e->count != 0)) {
+      e->count ++;
+      e->taken += taken;
+      return;
+    }
+    if (e->count == 0) {
+      if (nr_pc >= PC_TABLE_MAX_LOAD) { nr_dropped ++; return; }
+      e->pc = pc;
+      e->count = 1;
+      e->taken = taken;
+      nr_pc ++;
+      return;
+    }
+    i = (i + 1) & (PC_TABLE_SIZE - 1);
+  }
+}
+
+// --- output ---
+// "name+0xoff" of the symbol containing `pc', or "" without symbols
+static const char* pc_symbol(vaddr_t pc, char *buf, size_t len) {
+  word_t off = 0;
+  const char *name = elf_symbol(pc, &off);
+  if (name == NULL) return "";
+  snprintf(buf, len, "%s+0x%" PRIx64, name, (uint64_t)off);
+  return buf;
+}
+
+static int cmp_inst(const void *a, const void *b) {
+  uint64_t x = ((const InstStat *)a)->count, y = ((const InstStat *)b)->count;
+  return (x < y) - (x > y);
+}
+
+static int cmp_pc(const void *a, const void *b) {
+  uint64_t x = ((const PCStat *)a)->count, y = ((const PCStat *)b)->count;
+  return (x < y) - (x > y);
+}
+
+static void dump_csv(FILE *fp, InstStat *insts, PCStat *pcs) {
+  int i;
+  char buf[128];
+  fprintf(fp, "kind,key,count,taken,not_taken,symbol\n");
+  fprintf(fp, "total,instructions,%" PRIu64 ",,,\n", g_nr_guest_inst);
+  fprintf(fp, "total,dropped,%" PRIu64 ",,,\n", nr_dropped);
+  for (i = 0; i < nr_inst_name; i ++) {
+    fprintf(fp, "inst,%s,%" PRIu64 ",,,\n", insts[i].name, insts[i].count);
+  }
+  for (i = 0; i < nr_pc; i ++) {
+    fprintf(fp, "pc," FMT_WORD ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%s\n",
+        pcs[i].pc, pcs[i].count, pcs[i].taken, pcs[i].count - pcs[i].taken,
+        pc_symbol(pcs[i].pc, buf, sizeof(buf)));
+  }
+}
+
+static void dump_json(FILE *fp, InstStat *insts, PCStat *pcs) {
+  int i;
+  char buf[128];
+  fprintf(fp, "{\n  \"instructions\": %" PRIu64 ",\n  \"dropped\": %" PRIu64 ",\n",
+      g_nr_guest_inst, nr_dropped);
+  fprintf(fp, "  \"inst\": [");
+  for (i = 0; i < nr_inst_name; i ++) {
+    fprintf(fp, "%s\n    {\"name\": \"%s\", \"count\": %" PRIu64 "}",
+        (i == 0 ? "" : ","), insts[i].name, insts[i].count);
+  }
+  fprintf(fp, "\n  ],\n  \"pc\": [");
+  for (i = 0; i < nr_pc; i ++) {
+    fprintf(fp, "%s\n    {\"pc\": \"" FMT_WORD "\", \"symbol\": \"%s\", \"count\": %" PRIu64
+        ", \"taken\": %" PRIu64 "}", (i == 0 ? "" : ","), pcs[i].pc,
+        pc_symbol(pcs[i].pc, buf, sizeof(buf)), pcs[i].count, pcs[i].taken);
+  }
+  // control transfers, a conditional branch which is never taken can not be told from others
+  fprintf(fp, "\n  ],\n  \"branch\": [");
+  bool first = true;
+  for (i = 0; i < nr_pc; i ++) {
+    if (pcs[i].taken == 0) continue;
+    fprintf(fp, "%s\n    {\"pc\": \"" FMT_WORD "\", \"taken\": %" PRIu64 ", \"not_taken\": %" PRIu64
+        ", \"ratio\": %.4f}", (first ? "" : ","), pcs[i].pc, pcs[i].taken,
+        pcs[i].count - pcs[i].taken, (double)pcs[i].taken / pcs[i].count);
+    first = false;
+  }
+  fprintf(fp, "\n  ]\n}\n");
+}
+
+void profile_dump() {
+  const char *file = CONFIG_PROFILE_FILE;
+  FILE *fp = fopen(file, "w");
+  if (fp == NULL) {
+    Log("Can not open '%s', the profile is not written", file);
+    return;
+  }
+
+  PCStat *pcs = malloc(sizeof(PCStat) * (nr_pc + 1));
+  assert(pcs);
+  int i, j = 0;
+  for (i = 0; i < PC_TABLE_SIZE; i ++) {
+    if (pc_table[i].count != 0) pcs[j ++] = pc_table[i];
+  }
+  qsort(pcs, nr_pc, sizeof(PCStat), cmp_pc);
+  // the counters are still referenced by the decoders, sort a copy
+  InstStat insts[NR_INST_NAME];
+  memcpy(insts, inst_stat, sizeof(inst_stat));
+  qsort(insts, nr_inst_name, sizeof(InstStat), cmp_inst);
+
+  int len = strlen(file);
+  bool csv = (len >= 4 && strcmp(file + len - 4, ".csv") == 0);
+  if (csv) dump_csv(fp, insts, pcs);
+  else dump_json(fp, insts, pcs);
+
+  free(pcs);
+  fclose(fp);
+  Log("Profile is written to %s", file);
+}
+#endif
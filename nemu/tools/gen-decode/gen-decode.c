@@ -0,0 +1,190 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Read the INSTPAT table of an ISA and print a decision tree which jumps to
+ * the first matching pattern, see INSTPAT_DISPATCH() in include/cpu/decode.h.
+ *
+ * Usage: gen-decode inst.c > decode-tree.h
+ *
+ * At each node the bits fixed by most of the remaining patterns (usually the
+ * opcode, then funct3/funct7) are switched on. A pattern not fixing all these
+ * bits is kept in every branch it may match, so the leaves check the
+ * remaining patterns in source order as the linear matching does.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_PAT 1024
+#define MAX_LINE 4096
+
+typedef struct {
+  uint64_t key, mask;
+  int line;
+  char name[32];
+} Pattern;
+
+static Pattern pat[MAX_PAT];
+static int nr_pat = 0;
+static const char *file = NULL;
+
+static void fail(int line, const char *msg) {
+  fprintf(stderr, "%s:%d: %s\n", file, line, msg);
+  exit(1);
+}
+
+static void parse(FILE *fp) {
+  char buf[MAX_LINE];
+  int nr_table = 0;
+  for (int line = 1; fgets(buf, sizeof(buf), fp) != NULL; line ++) {
+    char *p = buf;
+    while (isspace(*p)) p ++;
+    if (strncmp(p, "INSTPAT_START(", 14) == 0) {
+      if (++ nr_table > 1) fail(line, "only one INSTPAT table is supported");
+      continue;
+    }
+    if (strncmp(p, "INSTPAT(\"", 9) != 0) continue;
+    if (nr_pat == MAX_PAT) fail(line, "too many patterns");
+
+    Pattern *t = &pat[nr_pat ++];
+    t->line = line;
+    int len = 0;
+    for (p += 9; *p != '"'; p ++) {
+      switch (*p) {
+        case ' ': continue;
+        case '0': case '1': case '?': break;
+        default: fail(line, "invalid character in pattern string");
+      }
+      if (++ len > 64) fail(line, "pattern too long");
+      t->key  = (t->key  << 1) | (*p == '1');
+      t->mask = (t->mask << 1) | (*p != '?');
+    }
+
+    // the name is only used in comments
+    p ++;
+    while (*p == ' ' || *p == ',') p ++;
+    int n = 0;
+    while (*p != '\0' && *p != ',' && *p != ' ' && n < sizeof(t->name) - 1) t->name[n ++] = *p ++;
+    t->name[n] = '\0';
+  }
+  if (nr_pat == 0) fail(0, "no INSTPAT found");
+}
+
+static void indent(int depth) {
+  printf("%*s", 2 * depth + 2, "");
+}
+
+static void gen_leaf(int *list, int n, uint64_t known, int depth) {
+  for (int i = 0; i < n; i ++) {
+    Pattern *t = &pat[list[i]];
+    indent(depth);
+    if ((t->mask & ~known) == 0) {
+      printf("goto __instpat_line_%d; /* %s */ \\\n", t->line, t->name);
+      return;
+    }
+    uint64_t mask = t->mask & ~known;
+    printf("if (((inst) & 0x%llxull) == 0x%llxull) goto __instpat_line_%d; /* %s */ \\\n",
+        (unsigned long long)mask, (unsigned long long)(t->key & mask), t->line, t->name);
+  }
+  indent(depth);
+  printf("goto *(__instpat_end); \\\n");
+}
+
+/* `list' holds the patterns which may match in source order,
+ * `used' is the bits already switched on, and `known' is the bits
+ * whose values are already checked for all patterns in `list'.
+ */
+static void gen_tree(int *list, int n, uint64_t used, uint64_t known, int depth) {
+  // choose the bits fixed by the most patterns
+  int count[64] = {0};
+  int max = 0;
+  for (int i = 0; i < n; i ++) {
+    uint64_t m = pat[list[i]].mask & ~used;
+    for (int b = 0; b < 64; b ++) {
+      if ((m >> b) & 1) { count[b] ++; if (count[b] > max) max = count[b]; }
+    }
+  }
+  if (n == 0 || max < 2 || (pat[list[0]].mask & ~known) == 0) {
+    gen_leaf(list, n, known, depth);
+    return;
+  }
+  uint64_t field = 0;
+  for (int b = 0; b < 64; b ++) {
+    if (count[b] == max) field |= 1ull << b;
+  }
+
+  int *sub = malloc(sizeof(int) * n);
+  indent(depth);
+  printf("switch ((inst) & 0x%llxull) { \\\n", (unsigned long long)field);
+  for (int i = 0; i < n; i ++) {
+    Pattern *t = &pat[list[i]];
+    if ((t->mask & field) != field) continue;
+    uint64_t val = t->key & field;
+    int first = 1;
+    for (int j = 0; j < i; j ++) {
+      Pattern *u = &pat[list[j]];
+      if ((u->mask & field) == field && (u->key & field) == val) { first = 0; break; }
+    }
+    if (!first) continue;
+
+    // the patterns which may match when the field equals `val'
+    int nr_sub = 0;
+    for (int j = 0; j < n; j ++) {
+      Pattern *u = &pat[list[j]];
+      if (((val ^ u->key) & u->mask & field) == 0) sub[nr_sub ++] = list[j];
+    }
+    indent(depth);
+    printf("case 0x%llxull: \\\n", (unsigned long long)val);
+    gen_tree(sub, nr_sub, used | field, known | field, depth + 1);
+  }
+  // the patterns which do not fix the whole field may match other values
+  int nr_sub = 0;
+  for (int j = 0; j < n; j ++) {
+    if ((pat[list[j]].mask & field) != field) sub[nr_sub ++] = list[j];
+  }
+  indent(depth);
+  printf("default: \\\n");
+  gen_tree(sub, nr_sub, used | field, known, depth + 1);
+  indent(depth);
+  printf("} \\\n");
+  free(sub);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s inst.c\n", argv[0]);
+    return 1;
+  }
+  file = argv[1];
+  FILE *fp = fopen(file, "r");
+  if (fp == NULL) {
+    perror(file);
+    return 1;
+  }
+  parse(fp);
+  fclose(fp);
+
+  int list[MAX_PAT];
+  for (int i = 0; i < nr_pat; i ++) list[i] = i;
+
+  printf("// generated by tools/gen-decode from %s, do not edit\n\n", file);
+  printf("#define INSTPAT_TREE(inst) do { \\\n");
+  gen_tree(list, nr_pat, 0, 0, 0);
+  printf("} while (0)\n");
+  return 0;
+}
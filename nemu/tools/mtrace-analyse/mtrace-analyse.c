@@ -0,0 +1,232 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+/* Analyse the binary memory trace written by NEMU with CONFIG_MTRACE.
+ * usage: mtrace-analyse [-l LINE_SIZE] [-n TOP_N] FILE
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+// should be the same as src/utils/mtrace.c
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+} MTraceHeader;
+
+typedef struct {
+  uint64_t pc;
+  uint64_t addr;
+  uint64_t value;
+  uint8_t len;
+  uint8_t type;
+  uint8_t pad[6];
+} MTraceRecord;
+
+enum { MEM_TYPE_IFETCH, MEM_TYPE_READ, MEM_TYPE_WRITE }; // the same as include/isa.h
+
+// --- a hash map from uint64_t to two counters, with linear probing ---
+typedef struct {
+  uint64_t key;
+  uint64_t a, b;
+  bool used;
+} Entry;
+
+typedef struct {
+  Entry *e;
+  uint64_t size, nr;
+} Map;
+
+static void map_init(Map *m) {
+  m->size = 1024;
+  m->nr = 0;
+  m->e = calloc(m->size, sizeof(Entry));
+  assert(m->e);
+}
+
+static inline uint64_t hash(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdull;
+  k ^= k >> 33;
+  return k;
+}
+
+static Entry* map_get(Map *m, uint64_t key);
+
+static void map_grow(Map *m) {
+  Map n = { .size = m->size * 2, .nr = 0 };
+  n.e = calloc(n.size, sizeof(Entry));
+  assert(n.e);
+  for (uint64_t i = 0; i < m->size; i ++) {
+    if (m->e[i].used) *map_get(&n, m->e[i].key) = m->e[i];
+  }
+  free(m->e);
+  *m = n;
+}
+
+// return the entry of `key', which is created with zero counters if absent
+static Entry* map_get(Map *m, uint64_t key) {
+  if (m->nr * 4 >= m->size * 3) map_grow(m);
+  uint64_t i = hash(key) & (m->size - 1);
+  while (m->e[i].used && m->e[i].key != key) i = (i + 1) & (m->size - 1);
+  Entry *e = &m->e[i];
+  if (!e->used) {
+    *e = (Entry) { .key = key, .used = true };
+    m->nr ++;
+  }
+  return e;
+}
+
+// entries sorted by a + b, in descending order
+static int cmp_entry(const void *x, const void *y) {
+  uint64_t p = ((const Entry *)x)->a + ((const Entry *)x)->b;
+  uint64_t q = ((const Entry *)y)->a + ((const Entry *)y)->b;
+  return (p < q) - (p > q);
+}
+
+static Entry* map_sorted(Map *m) {
+  Entry *s = malloc(sizeof(Entry) * (m->nr + 1));
+  assert(s);
+  uint64_t j = 0;
+  for (uint64_t i = 0; i < m->size; i ++) {
+    if (m->e[i].used) s[j ++] = m->e[i];
+  }
+  qsort(s, m->nr, sizeof(Entry), cmp_entry);
+  return s;
+}
+
+// --- analysis ---
+static int line_shift = 6;
+static int top_n = 10;
+
+static uint64_t nr_access[3] = {}, nr_bytes[3] = {}; // indexed by MEM_TYPE_*
+static uint64_t nr_regular = 0, nr_strided = 0;
+static Map lines, pages, strides, pcs, ilines;
+
+static void analyse(MTraceRecord *r) {
+  if (r->type > MEM_TYPE_WRITE) return;
+  nr_access[r->type] ++;
+  nr_bytes[r->type] += r->len;
+  // fetches only count for the code footprint, the rest is about data
+  if (r->type == MEM_TYPE_IFETCH) {
+    map_get(&ilines, r->addr >> line_shift)->a ++;
+    return;
+  }
+  bool is_write = (r->type == MEM_TYPE_WRITE);
+
+  Entry *e = map_get(&lines, r->addr >> line_shift);
+  if (is_write) e->b ++;
+  else e->a ++;
+  e = map_get(&pages, r->addr >> 12);
+  if (is_write) e->b ++;
+  else e->a ++;
+
+  // the stride between two accesses from the same pc,
+  // a = last address + 1 (0 means none), b = last stride
+  e = map_get(&pcs, r->pc);
+  if (e->a != 0) {
+    uint64_t stride = r->addr - (e->a - 1);
+    map_get(&strides, stride)->a ++;
+    nr_strided ++;
+    if (stride == e->b) nr_regular ++;
+    e->b = stride;
+  }
+  e->a = r->addr + 1;
+}
+
+static void report() {
+  uint64_t total = nr_access[MEM_TYPE_READ] + nr_access[MEM_TYPE_WRITE];
+  printf("fetches:     %" PRIu64 " (%" PRIu64 " bytes), %" PRIu64 " lines of code\n",
+      nr_access[MEM_TYPE_IFETCH], nr_bytes[MEM_TYPE_IFETCH], ilines.nr);
+  printf("accesses:    %" PRIu64 " (%" PRIu64 " reads, %" PRIu64 " writes)\n",
+      total, nr_access[MEM_TYPE_READ], nr_access[MEM_TYPE_WRITE]);
+  printf("bytes:       %" PRIu64 " read, %" PRIu64 " written\n",
+      nr_bytes[MEM_TYPE_READ], nr_bytes[MEM_TYPE_WRITE]);
+  printf("footprint:   %" PRIu64 " lines of %d bytes (%" PRIu64 " KiB), %" PRIu64 " pages of 4 KiB (%" PRIu64 " KiB)\n",
+      lines.nr, 1 << line_shift, (lines.nr << line_shift) / 1024, pages.nr, pages.nr * 4);
+  printf("memory pcs:  %" PRIu64 "\n", pcs.nr);
+  if (nr_strided != 0) {
+    printf("regular:     %.2f%% of the accesses repeat the last stride of their pc\n",
+        100.0 * nr_regular / nr_strided);
+  }
+
+  int i;
+  Entry *s = map_sorted(&strides);
+  printf("\ntop strides from the same pc:\n");
+  for (i = 0; i < top_n && i < strides.nr; i ++) {
+    printf("  %12" PRId64 " %12" PRIu64 " %6.2f%%\n", (int64_t)s[i].key, s[i].a, 100.0 * s[i].a / nr_strided);
+  }
+  free(s);
+
+  s = map_sorted(&lines);
+  printf("\nhot lines:\n  %18s %12s %12s %7s\n", "address", "reads", "writes", "share");
+  for (i = 0; i < top_n && i < lines.nr; i ++) {
+    printf("  0x%016" PRIx64 " %12" PRIu64 " %12" PRIu64 " %6.2f%%\n", s[i].key << line_shift,
+        s[i].a, s[i].b, 100.0 * (s[i].a + s[i].b) / total);
+  }
+  free(s);
+}
+
+int main(int argc, char *argv[]) {
+  int o;
+  while ((o = getopt(argc, argv, "l:n:")) != -1) {
+    switch (o) {
+      case 'l': {
+        int size = atoi(optarg);
+        for (line_shift = 0; (1 << line_shift) < size; line_shift ++);
+        if ((1 << line_shift) != size) { fprintf(stderr, "line size should be a power of 2\n"); return 1; }
+        break;
+      }
+      case 'n': top_n = atoi(optarg); break;
+      default: goto usage;
+    }
+  }
+  if (optind != argc - 1) {
+usage:
+    fprintf(stderr, "usage: %s [-l LINE_SIZE] [-n TOP_N] FILE\n", argv[0]);
+    return 1;
+  }
+
+  FILE *fp = fopen(argv[optind], "rb");
+  if (fp == NULL) { perror(argv[optind]); return 1; }
+  MTraceHeader hdr;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, "NEMUMTR", 8) != 0 ||
+      hdr.version != 2 || hdr.record_size != sizeof(MTraceRecord)) {
+    fprintf(stderr, "%s is not a memory trace of NEMU\n", argv[optind]);
+    return 1;
+  }
+
+  map_init(&lines);
+  map_init(&pages);
+  map_init(&strides);
+  map_init(&pcs);
+  map_init(&ilines);
+  static MTraceRecord buf[65536];
+  size_t n;
+  while ((n = fread(buf, sizeof(MTraceRecord), 65536, fp)) > 0) {
+    for (size_t i = 0; i < n; i ++) analyse(&buf[i]);
+  }
+  fclose(fp);
+
+  report();
+  return 0;
+}